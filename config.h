@@ -222,6 +222,25 @@
 // step smoothing. See stepper.c for more details on the AMASS system works.
 #define ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING  // Default enabled. Comment to disable.
 
+// Jerk-limited S-curve acceleration. The step segment generator shapes each acceleration and
+// deceleration ramp of the planner's trapezoid profiles as an S-curve, so the acceleration builds up
+// and dies away at the jerk set with $14 instead of switching on and off at every ramp. Each ramp
+// keeps the time and distance the planner gave it, and so the cycle time, but its peak acceleration
+// rises above the $12x average by up to 2x for short ramps. $14=0 runs plain trapezoids.
+// NOTE: The S-curve restarts at every planner block, and when a replan changes a ramp in progress.
+// #define S_CURVE_ACCELERATION // Default disabled. Uncomment to enable.
+
+// Input shaping against the ringing of the arm links after fast moves. The step segment generator
+// convolves each acceleration and deceleration ramp with the impulses of a ZV, ZVD or EI shaper,
+// selected with $15, which cancels the residual vibration at the resonance it is tuned to. Each axis
+// sets its resonant frequency with $17x (Hz, 0 for no shaping) and damping ratio with $18x. A block
+// is shaped for the resonances of all its moving axes at once, as far as SHAPER_MAX_IMPULSES allows.
+// Each shaped ramp keeps the planned distance, but its base acceleration rises to make up for the
+// shaper time, up to 2x the $12x acceleration. Ramps shorter than twice the shaper time run unshaped.
+// NOTE: ZV takes half a period of the resonance, ZVD and EI a full period. Combined shapers add up.
+// #define INPUT_SHAPING // Default disabled. Uncomment to enable.
+#define SHAPER_MAX_IMPULSES 9 // Two ZVD or EI shapers, or three ZV shapers. Takes 8 bytes of RAM each.
+
 // Sets the maximum step rate allowed to be written as a Grbl setting. This option enables an error 
 // check in the settings module to prevent settings values that will exceed this limitation. The maximum
 // step rate is strictly limited by the CPU speed and will change if something other than an AVR running
@@ -272,6 +291,14 @@
 // spindle RPM output lower than this value will be set to this value.
 // #define MINIMUM_SPINDLE_PWM 5 // Default disabled. Uncomment to enable. Integer (0-255)
 
+// Dynamic laser power for a laser on the spindle PWM output. M4 turns the S word output on as a laser
+// whose power follows the realtime speed: each step segment sets the PWM to the S word power times its
+// speed over the programmed feed rate, so acceleration ramps and corners burn as evenly as the cruise.
+// The laser is off while the machine stands still. M3 keeps the constant S word power. Rapids are
+// scaled like feeds, so turn the laser off around G0 moves.
+// NOTE: With VARIABLE_SPINDLE_2, M4 no longer turns on the E word output. An E word still sets it.
+// #define LASER_DYNAMIC_POWER // Default disabled. Uncomment to enable. Requires VARIABLE_SPINDLE.
+
 // By default on a 328p(Uno), Grbl combines the variable spindle PWM and the enable into one pin to help 
 // preserve I/O pins. For certain setups, these may need to be separate pins. This configure option uses
 // the spindle direction pin(D13) as a separate spindle enable pin along with spindle speed PWM on pin D11. 
@@ -305,6 +332,15 @@
 // machines, perhaps to 0.1mm/min, but your success may vary based on multiple factors.
 #define MINIMUM_FEED_RATE 1.0 // (mm/min)
 
+// Merges a new line into the newest queued planner block when the two are nearly collinear, so long
+// interpolated moves, like M20 Cartesian chords or fine CAM segments, take fewer planner blocks and
+// recalculations and the planner looks further ahead. The merged block is traced as one straight line,
+// which passes the merged segment ends at most PLANNER_COALESCE_DEVIATION steps off on any axis. The
+// line must have a nominal speed and acceleration up to PLANNER_COALESCE_TOLERANCE above the block's,
+// and runs at those of the block. Comment out PLANNER_COALESCE_DEVIATION to disable.
+#define PLANNER_COALESCE_DEVIATION 0.5 // (steps)
+#define PLANNER_COALESCE_TOLERANCE 0.01 // (fraction of nominal speed and acceleration)
+
 // Number of arc generation iterations by small angle approximation before exact arc trajectory 
 // correction with expensive sin() and cos() calcualtions. This parameter maybe decreased if there 
 // are issues with the accuracy of the arc generations, or increased if arc execution is getting
@@ -321,12 +357,16 @@
 // much greater than this. The default setting should capture most, if not all, full arc error situations.
 #define ARC_ANGULAR_TRAVEL_EPSILON 5E-7 // Float (radians)
 
-// Time delay increments performed during a dwell. The default value is set at 50ms, which provides
-// a maximum time delay of roughly 55 minutes, more than enough for most any application. Increasing
-// this delay will increase the maximum dwell time linearly, but also reduces the responsiveness of 
-// run-time command executions, like status reports, since these are performed between each dwell 
-// time step. Also, keep in mind that the Arduino delay timer is not very accurate for long delays.
-#define DWELL_TIME_STEP 50 // Integer (1-255) (milliseconds)
+// Smallest and largest corner, as the change of direction between two Cartesian lines, that G64 path
+// blending rounds. Flatter corners are taken at speed by the look-ahead anyway and would need long
+// blends, so the streamer holds back less of each line for them. Near reversals must stop regardless.
+// The held back part of a line is its last (G64 P tolerance)/tan(CARTESIAN_BLEND_MIN_ANGLE/4).
+#define CARTESIAN_BLEND_MIN_ANGLE 0.0873 // Float (radians), 5 degrees
+
+// Number of chords of checked Cartesian (M20) lines and arcs kept for the streamer, which queues their
+// joint angles instead of solving the move again. A move with more chords than fit solves the rest
+// again while it streams. Takes 32 bytes of RAM per chord.
+#define CARTESIAN_CHORD_BUFFER_SIZE 16 // Integer (2-255)
 
 // Creates a delay between the direction pin setting and corresponding step pulse by creating
 // another interrupt (Timer2 compare) to manage it. The main Grbl interrupt (Timer1 compare) 
@@ -344,7 +384,9 @@
 // available RAM, like when re-compiling for a Mega or Sanguino. Or decrease if the Arduino
 // begins to crash due to the lack of available RAM or if the CPU is having trouble keeping
 // up with planning new incoming motions as they are executed. 
-// #define BLOCK_BUFFER_SIZE 18  // Uncomment to override default in planner.h.
+// NOTE: A planner block takes 43 bytes (47 with USE_LINE_NUMBERS). The default of 48 blocks fits the
+// Mega2560 and looks several times further ahead over short Cartesian chords than the former 18.
+// #define BLOCK_BUFFER_SIZE 48  // Uncomment to override default in planner.h.
 
 // Governs the size of the intermediary step segment buffer between the step execution algorithm
 // and the planner blocks. Each segment is set of steps executed at a constant velocity over a
@@ -402,6 +444,12 @@
 // NOTE: This option has no effect if SOFTWARE_DEBOUNCE is enabled.
 // #define HARD_LIMIT_FORCE_STATE_CHECK // Default disabled. Uncomment to enable.
 
+// Replaces the libm sin/cos/atan2 calls of the per-point arm kinematics (inverse and forward
+// solutions, Cartesian line interpolation) with interpolated lookup tables in flash. Each call drops
+// from the order of 100us to a fraction of that on the AVR, which lets Cartesian lines be split into
+// more points without starving the stepper, at an angle error below 5e-6 rad. Costs ~2KB of flash.
+// #define KINEMATICS_TABLE_TRIG // Default disabled. Uncomment to enable.
+
 
 // ---------------------------------------------------------------------------------------
 // COMPILE-TIME ERROR CHECKING OF DEFINE VALUES:
@@ -414,6 +462,10 @@
   #error "USE_SPINDLE_DIR_AS_ENABLE_PIN may only be used with VARIABLE_SPINDLE enabled"
 #endif
 
+#if defined(LASER_DYNAMIC_POWER) && !defined(VARIABLE_SPINDLE)
+  #error "LASER_DYNAMIC_POWER may only be used with VARIABLE_SPINDLE enabled"
+#endif
+
 #if defined(USE_SPINDLE_DIR_AS_ENABLE_PIN) && !defined(CPU_MAP_ATMEGA328P)
   #error "USE_SPINDLE_DIR_AS_ENABLE_PIN may only be used with a 328p processor"
 #endif
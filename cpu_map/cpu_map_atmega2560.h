@@ -129,9 +129,8 @@
 #define F_LIMIT_BIT     1 
 #define G_LIMIT_BIT     4 
 
-#define LIMIT_INT       PCIE0  
-#define LIMIT_INT_vect  PCINT0_vect
-#define LIMIT_PCMSK     PCMSK0 
+// NOTE: Port D has no pin change interrupt on the Mega2560, so there is no LIMIT_INT_vect. The hard
+// limit switches are polled from the watchdog timer interrupt instead. See limits.c.
 #define LIMIT_MASK ((1<<A_LIMIT_BIT)|(1<<B_LIMIT_BIT)|(1<<C_LIMIT_BIT)|(1<<D_LIMIT_BIT)|(1<<E_LIMIT_BIT)|(1<<F_LIMIT_BIT)|(1<<G_LIMIT_BIT)) // All limit bits
 #define LIMIT_MASK_B_C_D_E_F_G ((1<<B_LIMIT_BIT)|(1<<C_LIMIT_BIT)|(1<<D_LIMIT_BIT)|(1<<E_LIMIT_BIT)|(1<<F_LIMIT_BIT)|(1<<G_LIMIT_BIT)) // All limit bits
 #define LIMIT_MASK_E (1<<E_LIMIT_BIT)// All limit bits
@@ -184,6 +183,7 @@
   // Advanced Configuration Below You should not need to touch these variables
   // Set Timer up to use TIMER4B which is attached to Digital Pin 7
   #define PWM_MAX_VALUE       65535.0
+  #define SPINDLE_PWM_TIMER   4
   #define TCCRA_REGISTER		TCCR4A
   #define TCCRB_REGISTER		TCCR4B
   #define OCR_REGISTER		OCR4B
@@ -207,6 +207,7 @@
 #define SPINDLE_PWM_BIT_2      4 // MEGA2560 Digital Pin 2  OC3B输出PWM
 
 #define PWM_MAX_VALUE_2		65535.0
+#define SPINDLE_PWM_TIMER_2     3
 #define TCCRA_REGISTER_2		  TCCR3A
 #define TCCRB_REGISTER_2		  TCCR3B
 #define OCR_REGISTER_2	  OCR3B
@@ -219,6 +220,14 @@
 
 #endif 
 
+// 16-bit timer the $K kinematics self test borrows to time the IK and FK solves. It must be free of
+// the stepper timers (Timer0, Timer1, Timer2) and the spindle PWM timers above.
+#define KINEMATICS_TEST_TIMER     5
+#define KINEMATICS_TEST_TCCRA     TCCR5A
+#define KINEMATICS_TEST_TCCRB     TCCR5B
+#define KINEMATICS_TEST_TCNT      TCNT5
+#define KINEMATICS_TEST_PRESCALER ((1<<CS51)|(1<<CS50)) // 1/64 prescaler: 4us per tick
+
 
 
 
@@ -81,6 +81,8 @@
   #define DEFAULT_STATUS_REPORT_MASK ((BITFLAG_RT_STATUS_MACHINE_POSITION)|(BITFLAG_RT_STATUS_WORK_POSITION)|(BITFLAG_RT_STATUS_Coordinate_MODE)|(BITFLAG_RT_STATUS_PUMP_PWM))
   #define DEFAULT_JUNCTION_DEVIATION 0.01 // mm
   #define DEFAULT_ARC_TOLERANCE 0.002 // mm
+  #define DEFAULT_JERK 0.0*60*60*60 // mm/min^3, 0 for trapezoid ramps
+  #define DEFAULT_SHAPER_TYPE 0 // SHAPER_NONE
   #define DEFAULT_REPORT_INCHES 0 // false
   #define DEFAULT_INVERT_ST_ENABLE 0 // false
   #define DEFAULT_INVERT_LIMIT_PINS 0 // false
@@ -102,6 +104,29 @@
   #define DEFAULTS_RESET_F 45.0
   #define DEFAULTS_RESET_G 45.0
 
+  #define DEFAULT_A_BACKLASH 0.0 // mm
+  #define DEFAULT_B_BACKLASH 0.0 // mm
+  #define DEFAULT_C_BACKLASH 0.0 // mm
+  #define DEFAULT_D_BACKLASH 0.0 // mm
+  #define DEFAULT_E_BACKLASH 0.0 // mm
+  #define DEFAULT_F_BACKLASH 0.0 // mm
+  #define DEFAULT_G_BACKLASH 0.0 // mm
+
+  #define DEFAULT_A_SHAPER_FREQUENCY 0.0 // Hz
+  #define DEFAULT_B_SHAPER_FREQUENCY 0.0 // Hz
+  #define DEFAULT_C_SHAPER_FREQUENCY 0.0 // Hz
+  #define DEFAULT_D_SHAPER_FREQUENCY 0.0 // Hz
+  #define DEFAULT_E_SHAPER_FREQUENCY 0.0 // Hz
+  #define DEFAULT_F_SHAPER_FREQUENCY 0.0 // Hz
+  #define DEFAULT_G_SHAPER_FREQUENCY 0.0 // Hz
+  #define DEFAULT_A_SHAPER_DAMPING 0.1
+  #define DEFAULT_B_SHAPER_DAMPING 0.1
+  #define DEFAULT_C_SHAPER_DAMPING 0.1
+  #define DEFAULT_D_SHAPER_DAMPING 0.1
+  #define DEFAULT_E_SHAPER_DAMPING 0.1
+  #define DEFAULT_F_SHAPER_DAMPING 0.1
+  #define DEFAULT_G_SHAPER_DAMPING 0.1
+
   #define DEFAULT_HOMING_POS_MASK 65 
 
   #define DEFAULTS_D1 78.0
@@ -111,9 +136,8 @@
   #define DEFAULTS_D4 170.0
   #define DEFAULTS_L -25.0
   #define DEFAULTS_use_interpolation 0
-  #define DEFAULTS_interpolation_num 50
-  #define DEFAULTS_use_compensation 0 
-  #define DEFAULTS_compensation_num 2
+  #define DEFAULTS_path_tolerance 0.1 // mm
+  #define DEFAULTS_tool_acceleration (200.0*60*60) // 200*60*60 mm/min^2 = 200 mm/sec^2
   #define DEFAULTS_use_reset_pos 1	
   #define DEFAULTS_use_Back_to_text 0
   #define DEFAULTS_offset_x 0
@@ -66,14 +66,81 @@ void gc_sync_position()
 }
 
 
-static uint8_t gc_check_same_position(float *pos_a, float *pos_b) 
+static uint8_t gc_check_same_position(float *pos_a, float *pos_b, uint8_t n_axis) 
 {
   uint8_t idx;
-  for (idx=0; idx<N_AXIS; idx++) {
+  for (idx=0; idx<n_axis; idx++) {
     if (pos_a[idx] != pos_b[idx]) { return(false); }
   }
   return(true);
 }
+
+
+// Loads the Cartesian start and target poses of a coordinate mode move. The start is the end of
+// the last Cartesian move, the target comes from the block's X,Y,Z,A,B,C words.
+static void gc_load_cartesian_line(pose_t *start, pose_t *target)
+{
+  uint8_t idx;
+  for (idx=0; idx<N_Cartesian; idx++) { start->coord[idx] = sys.position_Cartesian[idx]; }
+  target->coord[X_Cartesian] = gc_block.values.xyz[E_AXIS];
+  target->coord[Y_Cartesian] = gc_block.values.xyz[F_AXIS];
+  target->coord[Z_Cartesian] = gc_block.values.xyz[G_AXIS];
+  target->coord[RX_Cartesian] = gc_block.values.xyz[A_AXIS];
+  target->coord[RY_Cartesian] = gc_block.values.xyz[B_AXIS];
+  target->coord[RZ_Cartesian] = gc_block.values.xyz[C_AXIS];
+}
+
+
+// Traces a Cartesian line without queueing anything, so an unreachable line is rejected
+// whole instead of running up to its first bad point. The chords are kept for the streamer, see
+// mc_cartesian_keep(). Leaves the joint angles the line ends at in gc_block.values.joint.
+static uint8_t gc_check_cartesian_line()
+{
+  pose_t start, target;
+  cartesian_line_t line;
+  uint8_t status;
+  gc_load_cartesian_line(&start, &target);
+  status = ik_reachable(&target); // Cheap envelope test first. Skips the walk for most bad targets.
+  if (status) { return(status); }
+  mc_cartesian_check_begin();
+  cartesian_line_init(&line, &start, &target, gc_state.position, gc_block.values.l);
+  while (line.t < 1.0) {
+    status = cartesian_line_next(&line);
+    if (status) { return(status); }
+    mc_cartesian_keep(&line);
+  }
+  memcpy(gc_block.values.joint, line.joint.angle, sizeof(line.joint.angle));
+  gc_block.values.joint[D_AXIS] = gc_block.values.xyz[D_AXIS];
+  return(STATUS_OK);
+}
+
+
+// Hands a checked Cartesian line to the motion streamer and moves the parser to its end. A negative
+// feed_rate runs it at rapids.
+static void gc_execute_cartesian_line(float feed_rate)
+{
+  pose_t start, target;
+  gc_load_cartesian_line(&start, &target);
+  float blend = 0.0;
+  if (gc_state.modal.control == CONTROL_MODE_CONTINUOUS) { blend = gc_state.path_blend; }
+  mc_line_cartesian(&start, &target, gc_state.position, gc_block.values.l, feed_rate, 
+                    gc_state.modal.feed_rate, gc_block.values.xyz[D_AXIS], blend);
+  memcpy(sys.position_Cartesian, target.coord, sizeof(target.coord));
+  memcpy(gc_state.position, gc_block.values.joint, sizeof(gc_block.values.joint));
+}
+
+
+// Traces a checked Cartesian arc and moves the parser to its end.
+static void gc_execute_cartesian_arc(uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc)
+{
+  pose_t start, target;
+  gc_load_cartesian_line(&start, &target);
+  mc_arc_cartesian(&start, &target, gc_block.values.ijk, gc_block.values.r, gc_state.feed_rate, 
+    gc_state.modal.feed_rate, axis_0, axis_1, axis_linear, is_clockwise_arc, gc_state.position, gc_block.values.l,
+    gc_block.values.xyz[D_AXIS], false);
+  memcpy(sys.position_Cartesian, target.coord, sizeof(target.coord));
+  memcpy(gc_state.position, gc_block.values.joint, sizeof(gc_block.values.joint));
+}
          
 // Executes one line of 0-terminated G-Code. The line is assumed to contain only uppercase
 // characters and signed floating point values (no whitespace). Comments and block delete
@@ -93,6 +160,7 @@ uint8_t gc_execute_line(char *line)
   memcpy(&gc_block.modal,&gc_state.modal,sizeof(gc_modal_t)); // Copy current modes
   uint8_t axis_command = AXIS_COMMAND_NONE;
   uint8_t axis_0, axis_1, axis_linear;
+  pose_t arc_start, arc_end; // M20 G2/G3 start and target poses
   uint8_t coord_select = 0; // Tracks G10 P coordinate selection for execution
   float coordinate_data[N_AXIS]; // Multi-use variable to store coordinate data for execution
   float parameter_data[N_AXIS]; // Multi-use variable to store parameter data for execution
@@ -268,10 +336,11 @@ uint8_t gc_execute_line(char *line)
             word_bit = MODAL_GROUP_G12;
             gc_block.modal.coord_select = int_value-54; // Shift to array indexing.
             break;
-          case 61:
+          case 61: case 64:
             word_bit = MODAL_GROUP_G13;
             if (mantissa != 0) { FAIL(STATUS_GCODE_UNSUPPORTED_COMMAND); } // [G61.1 not supported]
-            // gc_block.modal.control = CONTROL_MODE_EXACT_PATH; // G61
+            if (int_value == 61) { gc_block.modal.control = CONTROL_MODE_EXACT_PATH; } // G61
+            else { gc_block.modal.control = CONTROL_MODE_CONTINUOUS; } // G64
             break;
           default: FAIL(STATUS_GCODE_UNSUPPORTED_COMMAND); // [Unsupported G command]
         }      
@@ -420,7 +489,11 @@ uint8_t gc_execute_line(char *line)
           case 'I': word_bit = WORD_I; gc_block.values.ijk[A_AXIS] = value; ijk_words |= (1<<A_AXIS); break;
           case 'J': word_bit = WORD_J; gc_block.values.ijk[B_AXIS] = value; ijk_words |= (1<<B_AXIS); break;
           case 'K': word_bit = WORD_K; gc_block.values.ijk[C_AXIS] = value; ijk_words |= (1<<C_AXIS); break;
-          case 'L': word_bit = WORD_L; gc_block.values.l = int_value; break;
+          case 'L': word_bit = WORD_L;
+            // L is an integer index. Checked on the raw value, which int_value truncates and wraps.
+            if ((value < 0) || (value > 255) || (value != trunc(value))) { FAIL(STATUS_BAD_NUMBER_FORMAT); }
+            gc_block.values.l = int_value;
+            break;
           case 'N': word_bit = WORD_N; gc_block.values.n = trunc(value); break;
           case 'P': word_bit = WORD_P; gc_block.values.p = value; break;
           // NOTE: For certain commands, P value must be an integer, but none of these commands are supported.
@@ -621,7 +694,18 @@ uint8_t gc_execute_line(char *line)
     }
   }
   
-  // [16. Set path control mode ]: N/A. Only G61. G61.1 and G64 NOT SUPPORTED.
+  // [16. Set path control mode ]: G61.1 NOT SUPPORTED. G64 P is the corner tolerance of M20 lines, $46
+  //   without P. NOTE: A G4 or G10 in the same block keeps its P word. Negative P done.
+  float path_blend = gc_state.path_blend;
+  if (bit_istrue(command_words,bit(MODAL_GROUP_G13)) && (gc_block.modal.control == CONTROL_MODE_CONTINUOUS)) {
+    if (bit_istrue(value_words,bit(WORD_P)) && (gc_block.non_modal_command != NON_MODAL_SET_COORDINATE_DATA)) {
+      path_blend = gc_block.values.p;
+      if (gc_block.modal.units == UNITS_MODE_INCHES) { path_blend *= MM_PER_INCH; }
+      bit_false(value_words,bit(WORD_P));
+    } else {
+      path_blend = settings.robot_qinnew.path_tolerance;
+    }
+  }
   // [17. Set distance mode ]: N/A. Only G91.1. G90.1 NOT SUPPORTED.
   // [18. Set retract mode ]: NOT SUPPORTED.
   
@@ -812,16 +896,29 @@ uint8_t gc_execute_line(char *line)
           // NOTE: Both radius and offsets are required for arc tracing and are pre-computed with the error-checking.
         
           if (!axis_words) { FAIL(STATUS_GCODE_NO_AXIS_WORDS); } // [No axis words]
-          if (!(axis_words & (bit(axis_0)|bit(axis_1)))) { FAIL(STATUS_GCODE_NO_AXIS_WORDS_IN_PLANE); } // [No axis words in plane]
+          // In coordinate mode the arc is traced in Cartesian space. The plane axes then index the
+          // X_Cartesian..Z_Cartesian poses, whose X,Y,Z words are parsed into the E,F,G axes.
+          float *arc_position = gc_state.position;
+          float *arc_target = gc_block.values.xyz;
+          uint16_t plane_words = axis_words;
+          uint8_t n_arc_axis = N_AXIS;
+          if (gc_state.coord_mode == coordinate_mode) {
+            gc_load_cartesian_line(&arc_start, &arc_end);
+            arc_position = arc_start.coord;
+            arc_target = arc_end.coord;
+            plane_words = axis_words >> E_AXIS;
+            n_arc_axis = N_Cartesian;
+          }
+          if (!(plane_words & (bit(axis_0)|bit(axis_1)))) { FAIL(STATUS_GCODE_NO_AXIS_WORDS_IN_PLANE); } // [No axis words in plane]
         
           // Calculate the change in position along each selected axis
           float x,y;
-          x = gc_block.values.xyz[axis_0]-gc_state.position[axis_0]; // Delta x between current position and target
-          y = gc_block.values.xyz[axis_1]-gc_state.position[axis_1]; // Delta y between current position and target
+          x = arc_target[axis_0]-arc_position[axis_0]; // Delta x between current position and target
+          y = arc_target[axis_1]-arc_position[axis_1]; // Delta y between current position and target
 
           if (value_words & bit(WORD_R)) { // Arc Radius Mode  
             bit_false(value_words,bit(WORD_R));
-            if (gc_check_same_position(gc_state.position, gc_block.values.xyz)) { FAIL(STATUS_GCODE_INVALID_TARGET); } // [Invalid target]
+            if (gc_check_same_position(arc_position, arc_target, n_arc_axis)) { FAIL(STATUS_GCODE_INVALID_TARGET); } // [Invalid target]
           
             // Convert radius value to proper units.
             if (gc_block.modal.units == UNITS_MODE_INCHES) { gc_block.values.r *= MM_PER_INCH; }
@@ -945,10 +1042,36 @@ uint8_t gc_execute_line(char *line)
           //   an error, it issues an alarm to prevent further motion to the probe. It's also done there to 
           //   allow the planner buffer to empty and move off the probe trigger before another probing cycle.
           if (!axis_words) { FAIL(STATUS_GCODE_NO_AXIS_WORDS); } // [No axis words]
-          if (gc_check_same_position(gc_state.position, gc_block.values.xyz)) { FAIL(STATUS_GCODE_INVALID_TARGET); } // [Invalid target]
+          if (gc_check_same_position(gc_state.position, gc_block.values.xyz, N_AXIS)) { FAIL(STATUS_GCODE_INVALID_TARGET); } // [Invalid target]
           break;
       } 
     }
+
+    // [M20 G0/G1/G2/G3 Errors]: L word is not an IK configuration. An interpolated point of the Cartesian
+    //   line or arc has no IK solution. NOTE: Without an L word the solution nearest the current joints is used.
+    if ((gc_state.coord_mode == coordinate_mode) && (axis_command == AXIS_COMMAND_MOTION_MODE)) {
+      if (bit_istrue(value_words,bit(WORD_L))) {
+        if (gc_block.values.l > IK_CONFIG_MAX) { FAIL(STATUS_BAD_NUMBER_FORMAT); } // [Invalid IK configuration]
+        bit_false(value_words,bit(WORD_L));
+      } else {
+        gc_block.values.l = IK_CONFIG_NEAREST;
+      }
+      uint8_t status = STATUS_OK;
+      switch (gc_block.modal.motion) {
+        case MOTION_MODE_SEEK: case MOTION_MODE_LINEAR:
+          status = gc_check_cartesian_line();
+          break;
+        case MOTION_MODE_CW_ARC: case MOTION_MODE_CCW_ARC:
+          status = ik_reachable(&arc_end);
+          if (status) { break; }
+          memcpy(gc_block.values.joint, gc_state.position, sizeof(gc_state.position));
+          status = mc_arc_cartesian(&arc_start, &arc_end, gc_block.values.ijk, gc_block.values.r, gc_block.values.f,
+            gc_block.modal.feed_rate, axis_0, axis_1, axis_linear, (gc_block.modal.motion == MOTION_MODE_CW_ARC),
+            gc_block.values.joint, gc_block.values.l, gc_block.values.xyz[D_AXIS], true);
+          break;
+      }
+      if (status) { FAIL(status); }
+    }
   }
   
   // [21. Program flow ]: No error checks required.
@@ -1018,9 +1141,15 @@ uint8_t gc_execute_line(char *line)
    if(gc_block.modal.spindle == SPINDLE_ENABLE_CW)//M3,pwm1输出
     {spindle_run(gc_block.modal.spindle, gc_state.spindle_speed);
     gc_state.modal.spindle = gc_block.modal.spindle;  } 
+#ifdef LASER_DYNAMIC_POWER
+   if(gc_block.modal.spindle == SPINDLE_ENABLE_CCW) // M4, S word output as a laser scaled with the speed
+   	{spindle_run(gc_block.modal.spindle, gc_state.spindle_speed);
+    gc_state.modal.spindle = gc_block.modal.spindle;  } 
+#else
    if(gc_block.modal.spindle == SPINDLE_ENABLE_CCW)
    	{spindle_run_2(gc_block.modal.spindle, gc_state.spindle_speed_2);
     gc_state.modal.spindle = gc_block.modal.spindle;  } 
+#endif
    if(gc_block.modal.spindle == SPINDLE_DISABLE)
    	{
 		spindle_run(gc_block.modal.spindle, gc_state.spindle_speed);
@@ -1040,7 +1169,13 @@ uint8_t gc_execute_line(char *line)
   // [9. Enable/disable feed rate or spindle overrides ]: NOT SUPPORTED
 
   // [10. Dwell ]:
-  if (gc_block.non_modal_command == NON_MODAL_DWELL) { mc_dwell(gc_block.values.p); }
+  if (gc_block.non_modal_command == NON_MODAL_DWELL) { 
+    #ifdef USE_LINE_NUMBERS
+      mc_dwell(gc_block.values.p, gc_state.line_number);
+    #else
+      mc_dwell(gc_block.values.p); 
+    #endif
+  }
   
   // [11. Set active plane ]:
   gc_state.modal.plane_select = gc_block.modal.plane_select;  
@@ -1070,8 +1205,9 @@ uint8_t gc_execute_line(char *line)
     memcpy(gc_state.coord_system,coordinate_data,sizeof(coordinate_data));
   }
   
-  // [16. Set path control mode ]: G61.1/G64 NOT SUPPORTED
-  // gc_state.modal.control = gc_block.modal.control; // NOTE: Always default.
+  // [16. Set path control mode ]: G61.1 NOT SUPPORTED
+  gc_state.modal.control = gc_block.modal.control;
+  gc_state.path_blend = path_blend;
   
   // [17. Set distance mode ]:
   gc_state.modal.distance = gc_block.modal.distance;
@@ -1092,13 +1228,13 @@ uint8_t gc_execute_line(char *line)
         #ifdef USE_LINE_NUMBERS
           mc_line(gc_block.values.xyz, -1.0, false, gc_state.line_number);
         #else
-          mc_line(gc_block.values.xyz, -1.0, false, false);
+          mc_line(gc_block.values.xyz, -1.0, false);
         #endif
       }
       #ifdef USE_LINE_NUMBERS
         mc_line(parameter_data, -1.0, false, gc_state.line_number); 
       #else
-        mc_line(parameter_data, -1.0, false, false); 
+        mc_line(parameter_data, -1.0, false); 
       #endif
       memcpy(gc_state.position, parameter_data, sizeof(parameter_data));
       break;
@@ -1140,126 +1276,14 @@ uint8_t gc_execute_line(char *line)
 	#endif
 			if(gc_state.coord_mode == coordinate_mode)
 				{	
-			
-					printString_debug("\r\nin case coordinate_mode");
-
-					float difference[N_Cartesian];
-					float current_position[N_Cartesian];
-					
-					for(int i = 0;i< N_Cartesian;i++ )
-						{
-						current_position[i] = sys.position_Cartesian[i];
-						}
-					
-					
-					difference[X_Cartesian] = gc_block.values.xyz[E_AXIS] - current_position[X_Cartesian];
-					difference[Y_Cartesian] = gc_block.values.xyz[F_AXIS] - current_position[Y_Cartesian];
-					difference[Z_Cartesian] = gc_block.values.xyz[G_AXIS] - current_position[Z_Cartesian];
-					difference[RX_Cartesian] = gc_block.values.xyz[A_AXIS] - current_position[RX_Cartesian];
-					difference[RY_Cartesian] = gc_block.values.xyz[B_AXIS] - current_position[RY_Cartesian];
-					difference[RZ_Cartesian] = gc_block.values.xyz[C_AXIS] - current_position[RZ_Cartesian];
-					
-					printString_debug("\r\ndifference[X_Cartesian]:");printInteger_debug(difference[X_Cartesian]);
-					printString_debug("\r\ndifference[Y_Cartesian]:");printInteger_debug(difference[Y_Cartesian]);
-					printString_debug("\r\ndifference[Z_Cartesian]:");printInteger_debug(difference[Z_Cartesian]);
-					
-					
-					sys.position_Cartesian[X_Cartesian] = gc_block.values.xyz[E_AXIS];
-					sys.position_Cartesian[Y_Cartesian] = gc_block.values.xyz[F_AXIS];
-					sys.position_Cartesian[Z_Cartesian] = gc_block.values.xyz[G_AXIS];
-					sys.position_Cartesian[RX_Cartesian] = gc_block.values.xyz[A_AXIS];
-					sys.position_Cartesian[RY_Cartesian] = gc_block.values.xyz[B_AXIS];
-					sys.position_Cartesian[RZ_Cartesian] = gc_block.values.xyz[C_AXIS];
-					
-					float cartesian_mm = sqrt(	pow(difference[X_Cartesian],2) +  
-									pow(difference[Y_Cartesian],2) +
-									pow(difference[Z_Cartesian],2));
-					//if (cartesian_mm < 0.000001) { break; }
-					printString_debug("\r\ncartesian_mm:");printInteger_debug(cartesian_mm);
-					float seconds = settings.robot_qinnew.interpolation_num * cartesian_mm / gc_state.feed_rate;
-					printString_debug("\r\nseconds:");printInteger_debug(seconds);
-					int steps = 1;
-					if(settings.robot_qinnew.use_interpolation)
-						{
-						steps = max(1, (int)(25 * seconds));
-						}
-					printString_debug("\r\nsteps:");printInteger_debug(steps);
-					float destination[N_Cartesian];
-					
-
-#if 0
-					static bool axis_Directionflag_last = 0;
-					bool axis_Directionflag;
-					int32_t target_steps_temp;
-					float temp[7] ={0,0,0,0,0,0,0};
-#endif
-
-					for (int s = 1; s <= steps; s++) 
-						{
-						float fraction = (float)s / (float)steps;
-							destination[X_Cartesian] = current_position[X_Cartesian] + difference[X_Cartesian] * fraction;
-							destination[Y_Cartesian] = current_position[Y_Cartesian] + difference[Y_Cartesian] * fraction;
-							destination[Z_Cartesian] = current_position[Z_Cartesian] + difference[Z_Cartesian] * fraction;
-							destination[RX_Cartesian] = current_position[RX_Cartesian] + difference[RX_Cartesian] * fraction;
-							destination[RY_Cartesian] = current_position[RY_Cartesian] + difference[RY_Cartesian] * fraction;
-							destination[RZ_Cartesian] = current_position[RZ_Cartesian] + difference[RZ_Cartesian] * fraction;
-							
-							InverseInit();
-							//Inverse(destination[X_Cartesian],destination[Y_Cartesian],destination[Z_Cartesian],gc_block.values.xyz[A_AXIS],gc_block.values.xyz[B_AXIS],gc_block.values.xyz[C_AXIS]);
-							Inverse(destination[X_Cartesian],destination[Y_Cartesian],destination[Z_Cartesian],destination[RX_Cartesian],destination[RY_Cartesian],destination[RZ_Cartesian]);
-
-#if 0
-						
-							memcpy(temp, gc_state.position, sizeof(gc_state.position));
-							target_steps_temp = lround(temp[E_AXIS]*settings.steps_per_mm[E_AXIS]);
-						if((target_steps_temp - get_pl(E_AXIS)) != 0)
-							{
-							if((target_steps_temp - get_pl(E_AXIS)) > 0)
-								{
-									axis_Directionflag = false;
-								}
-							if((target_steps_temp - get_pl(E_AXIS)) < 0)
-								{
-									axis_Directionflag = true;
-								}
-							//	printString("\r\naxis_Directionflag:\r\n");
-							//	printInteger(axis_Directionflag);
-							//	printString("\r\target_steps_temp - get_pl(E_AXIS):\r\n");
-							//	printInteger(target_steps_temp - get_pl(E_AXIS));
-
-							if(axis_Directionflag != axis_Directionflag_last)
-								{
-								
-								if(axis_Directionflag == false)
-									{temp[4] +=settings.robot_qinnew.compensation_num;
-								//	printString("\r\nin forward compensation\r\n");
-									}
-								else
-									{temp[4] -=settings.robot_qinnew.compensation_num;
-								//	printString("\r\nin inverse compensation\r\n");
-									}
-								
-								mc_line(temp, -1.0, false, true);
-								}
-							 axis_Directionflag_last = axis_Directionflag; 
-							}
-	#endif
-							gc_state.position[D_AXIS] = gc_block.values.xyz[D_AXIS];
-							mc_line(gc_state.position, -1.0, false, false);
-							
-						}
-							
-							break;
-
-					
-					
-
+					gc_execute_cartesian_line(-1.0);
+					break;
 				}	
           #ifdef USE_LINE_NUMBERS
             mc_line(gc_block.values.xyz, -1.0, false, gc_state.line_number);
           #else
 		
-            mc_line(gc_block.values.xyz, -1.0, false ,false);
+            mc_line(gc_block.values.xyz, -1.0, false);
           #endif
           break;
         case MOTION_MODE_LINEAR:
@@ -1268,126 +1292,22 @@ uint8_t gc_execute_line(char *line)
 
 			if(gc_state.coord_mode == coordinate_mode)
 				{	
-					printString_debug("in case coordinate_mode\r\n");
-					float difference[N_Cartesian];
-					float current_position[6];
-					
-					for(int i = 0;i< N_Cartesian;i++ )
-						{
-						current_position[i] = sys.position_Cartesian[i];
-						}
-					
-					difference[X_Cartesian] = gc_block.values.xyz[E_AXIS] - current_position[X_Cartesian];
-					difference[Y_Cartesian] = gc_block.values.xyz[F_AXIS] - current_position[Y_Cartesian];
-					difference[Z_Cartesian] = gc_block.values.xyz[G_AXIS] - current_position[Z_Cartesian];
-					difference[RX_Cartesian] = gc_block.values.xyz[A_AXIS] - current_position[RX_Cartesian];
-					difference[RY_Cartesian] = gc_block.values.xyz[B_AXIS] - current_position[RY_Cartesian];
-					difference[RZ_Cartesian] = gc_block.values.xyz[C_AXIS] - current_position[RZ_Cartesian];
-
-					printString_debug("difference[X_Cartesian]:");printInteger_debug(difference[X_Cartesian]);
-					printString_debug("difference[Y_Cartesian]:");printInteger_debug(difference[Y_Cartesian]);
-					printString_debug("difference[Z_Cartesian]:");printInteger_debug(difference[Z_Cartesian]);
-					
-
-					sys.position_Cartesian[X_Cartesian] = gc_block.values.xyz[E_AXIS];
-					sys.position_Cartesian[Y_Cartesian] = gc_block.values.xyz[F_AXIS];
-					sys.position_Cartesian[Z_Cartesian] = gc_block.values.xyz[G_AXIS];
-					sys.position_Cartesian[RX_Cartesian] = gc_block.values.xyz[A_AXIS];
-					sys.position_Cartesian[RY_Cartesian] = gc_block.values.xyz[B_AXIS];
-					sys.position_Cartesian[RZ_Cartesian] = gc_block.values.xyz[C_AXIS];
-					
-					float cartesian_mm = sqrt(	pow(difference[X_Cartesian],2) +  
-									pow(difference[Y_Cartesian],2) +
-									pow(difference[Z_Cartesian],2));
-				//	if (cartesian_mm < 0.000001) { break; }
-					printString_debug("\r\ncartesian_mm:");printInteger_debug(cartesian_mm);
-					float seconds = settings.robot_qinnew.interpolation_num * cartesian_mm / gc_state.feed_rate;
-					printString_debug("\r\nseconds:");printInteger_debug(seconds);
-					int steps = 1;
-
-					if(settings.robot_qinnew.use_interpolation)
-						{
-						steps = max(1, (int)(25 * seconds));
-						}
-					printString_debug("\r\nsteps:");printInteger_debug(steps);
-					float destination[N_Cartesian];
-					
-
-#if 1
-					static bool axis_Directionflag_last = 0;
-					bool axis_Directionflag;
-					int32_t target_steps_temp;
-					float temp[7] ={0,0,0,0,0,0,0};
-#endif
-
-					for (int s = 1; s <= steps; s++) 
-						{
-						float fraction = (float)s / (float)steps;
-							
-							destination[X_Cartesian] = current_position[X_Cartesian] + difference[X_Cartesian] * fraction;
-							destination[Y_Cartesian] = current_position[Y_Cartesian] + difference[Y_Cartesian] * fraction;
-							destination[Z_Cartesian] = current_position[Z_Cartesian] + difference[Z_Cartesian] * fraction;
-							destination[RX_Cartesian] = current_position[RX_Cartesian] + difference[RX_Cartesian] * fraction;
-							destination[RY_Cartesian] = current_position[RY_Cartesian] + difference[RY_Cartesian] * fraction;
-							destination[RZ_Cartesian] = current_position[RZ_Cartesian] + difference[RZ_Cartesian] * fraction;
-							
-							InverseInit();
-							Inverse(destination[X_Cartesian],destination[Y_Cartesian],destination[Z_Cartesian],destination[RX_Cartesian],destination[RY_Cartesian],destination[RZ_Cartesian]);
-
-#if 1
-                  if(1 == settings.robot_qinnew.use_compensation)
-                  	{
-						
-							memcpy(temp, gc_state.position, sizeof(gc_state.position));
-							target_steps_temp = lround(temp[E_AXIS]*settings.steps_per_mm[E_AXIS]);
-						if((target_steps_temp - get_pl(E_AXIS)) != 0)
-							{
-							if((target_steps_temp - get_pl(E_AXIS)) > 0)
-								{
-									axis_Directionflag = false;
-								}
-							if((target_steps_temp - get_pl(E_AXIS)) < 0)
-								{
-									axis_Directionflag = true;
-								}
-							
-
-							if(axis_Directionflag != axis_Directionflag_last)
-								{
-								
-								if(axis_Directionflag == false)
-									{temp[4] +=settings.robot_qinnew.compensation_num;
-								
-									}
-								else
-									{temp[4] -=settings.robot_qinnew.compensation_num;
-								
-									}
-								
-								mc_line(temp, gc_state.feed_rate, gc_state.modal.feed_rate, true);
-								}
-							 axis_Directionflag_last = axis_Directionflag; 
-							}
-                  	}
-	#endif
-							gc_state.position[D_AXIS] = gc_block.values.xyz[D_AXIS];
-							mc_line(gc_state.position, gc_state.feed_rate, gc_state.modal.feed_rate, false);
-							
-						}
-							break;
-
-					
-
+					gc_execute_cartesian_line(gc_state.feed_rate);
+					break;
 				}	
           #ifdef USE_LINE_NUMBERS
             mc_line(gc_block.values.xyz, -1.0, false, gc_state.line_number);
           #else
 
-            mc_line(gc_block.values.xyz, gc_state.feed_rate, gc_state.modal.feed_rate, false);
+            mc_line(gc_block.values.xyz, gc_state.feed_rate, gc_state.modal.feed_rate);
           #endif
           break;
         case MOTION_MODE_CW_ARC: 
 			printString("in case MOTION_MODE_CW_ARC\r\n");
+          if (gc_state.coord_mode == coordinate_mode) {
+            gc_execute_cartesian_arc(axis_0, axis_1, axis_linear, true);
+            break;
+          }
           #ifdef USE_LINE_NUMBERS
             mc_arc(gc_state.position, gc_block.values.xyz, gc_block.values.ijk, gc_block.values.r, 
               gc_state.feed_rate, gc_state.modal.feed_rate, axis_0, axis_1, axis_linear, true, gc_state.line_number);  
@@ -1397,6 +1317,10 @@ uint8_t gc_execute_line(char *line)
           #endif
           break;        
         case MOTION_MODE_CCW_ARC:
+          if (gc_state.coord_mode == coordinate_mode) {
+            gc_execute_cartesian_arc(axis_0, axis_1, axis_linear, false);
+            break;
+          }
           #ifdef USE_LINE_NUMBERS
             mc_arc(gc_state.position, gc_block.values.xyz, gc_block.values.ijk, gc_block.values.r, 
               gc_state.feed_rate, gc_state.modal.feed_rate, axis_0, axis_1, axis_linear, false, gc_state.line_number);  
@@ -1443,16 +1367,8 @@ uint8_t gc_execute_line(char *line)
 	  	//memcpy(gc_state.position_Cartesian, gc_block.values.xyz, sizeof(gc_block.values.xyz));
 	
       	{
-      	if(0 == settings.robot_qinnew.use_compensation)
-                  	{
-                  		if(sys.soft_limit_trigger_flag == 8)
-						{memcpy(gc_state.position_Cartesian, gc_block.values.xyz, sizeof(gc_block.values.xyz));}
-						else 
-						{}
-      				}else
-                  			{
-							memcpy(gc_state.position_Cartesian, gc_block.values.xyz, sizeof(gc_block.values.xyz));
-							}
+      	if(sys.soft_limit_trigger_flag == 8)
+			{memcpy(gc_state.position_Cartesian, gc_block.values.xyz, sizeof(gc_block.values.xyz));}
 			}
 		
 	  else
@@ -1543,5 +1459,5 @@ uint8_t gc_execute_line(char *line)
    group 8 = {*M7} enable mist coolant (* Compile-option)
    group 9 = {M48, M49} enable/disable feed and speed override switches
    group 10 = {G98, G99} return mode canned cycles
-   group 13 = {G61.1, G64} path control mode (G61 is supported)
+   group 13 = {G61.1} path control mode (G61 and G64 are supported)
 */
@@ -48,7 +48,7 @@
 #define MODAL_GROUP_G7 7 // [G40] Cutter radius compensation mode. G41/42 NOT SUPPORTED.
 #define MODAL_GROUP_G8 8 // [G43.1,G49] Tool length offset
 #define MODAL_GROUP_G12 9 // [G54,G55,G56,G57,G58,G59] Coordinate system selection
-#define MODAL_GROUP_G13 10 // [G61] Control mode
+#define MODAL_GROUP_G13 10 // [G61,G64] Control mode
 
 #define MODAL_GROUP_M4 11  // [M0,M1,M2,M30] Stopping
 #define MODAL_GROUP_M7 12 // [M3,M4,M5] Spindle turning
@@ -115,6 +115,7 @@
 
 // Modal Group G13: Control mode
 #define CONTROL_MODE_EXACT_PATH 0 // G61 (Default: Must be zero)
+#define CONTROL_MODE_CONTINUOUS 1 // G64
 
 // Modal Group M7: Spindle control
 #define SPINDLE_DISABLE 0 // M5 (Default: Must be zero)
@@ -172,7 +173,7 @@ typedef struct {
   // uint8_t cutter_comp;  // {G40} NOTE: Don't track. Only default supported.
   uint8_t tool_length;     // {G43.1,G49}
   uint8_t coord_select;    // {G54,G55,G56,G57,G58,G59}
-  // uint8_t control;      // {G61} NOTE: Don't track. Only default supported.
+  uint8_t control;         // {G61,G64}
   uint8_t program_flow;    // {M0,M1,M2,M30}
   uint8_t coolant;         // {M7,M8,M9}
   uint8_t spindle;         // {M3,M4,M5}
@@ -191,6 +192,7 @@ typedef struct {
   uint16_t s_2;       //               
   uint8_t t;       // Tool selection
   float xyz[7];    // A,B,C,D,E,F,G Translational axes
+  float joint[N_AXIS]; // M20 G0/G1: joint angles at the end of the Cartesian line
 } gc_values_t;
 
 
@@ -214,6 +216,7 @@ typedef struct {
   float coord_offset[N_AXIS];   // Retains the G92 coordinate offset (work coordinates) relative to
                                 // machine zero in mm. Non-persistent. Cleared upon reset and boot.    
   float tool_length_offset;     // Tracks tool length offset value when enabled.
+  float path_blend;             // G64 P corner tolerance of Cartesian lines in mm.
   uint8_t coord_mode;      // {M20,M21}
 } parser_state_t;
 extern parser_state_t gc_state;
@@ -49,10 +49,25 @@ void limits_init()
   #endif
 
   
-  #ifdef ENABLE_SOFTWARE_DEBOUNCE
+  #ifdef LIMIT_INT_vect
+    if (bit_istrue(settings.flags,BITFLAG_HARD_LIMIT_ENABLE)) {
+      LIMIT_PCMSK |= LIMIT_MASK; // Enable specific pins of pin change interrupt
+      PCICR |= (1 << LIMIT_INT); // Enable Pin Change Interrupt
+    } else {
+      limits_disable(); 
+    }
+
+    #ifdef ENABLE_SOFTWARE_DEBOUNCE
+      MCUSR &= ~(1<<WDRF);
+      WDTCSR |= (1<<WDCE) | (1<<WDE);
+      WDTCSR = (1<<WDP0); // Set time-out at ~32msec.
+    #endif
+  #else
+    // Without a limit pin interrupt, the watchdog timer interrupt polls the switches every ~16msec.
     MCUSR &= ~(1<<WDRF);
     WDTCSR |= (1<<WDCE) | (1<<WDE);
-    WDTCSR = (1<<WDP0); // Set time-out at ~32msec.
+    WDTCSR = 0; // Stopped. Set time-out at ~16msec.
+    if (bit_istrue(settings.flags,BITFLAG_HARD_LIMIT_ENABLE)) { WDTCSR |= (1<<WDIE); } // Interrupt mode
   #endif
 }
 
@@ -60,8 +75,12 @@ void limits_init()
 // Disables hard limits.
 void limits_disable()
 {
-  LIMIT_PCMSK &= ~LIMIT_MASK;  // Disable specific pins of the Pin Change Interrupt
-  PCICR &= ~(1 << LIMIT_INT);  // Disable Pin Change Interrupt
+  #ifdef LIMIT_INT_vect
+    LIMIT_PCMSK &= ~LIMIT_MASK;  // Disable specific pins of the Pin Change Interrupt
+    PCICR &= ~(1 << LIMIT_INT);  // Disable Pin Change Interrupt
+  #else
+    WDTCSR &= ~(1<<WDIE); // Stop polling.
+  #endif
 }
 
 
@@ -113,7 +132,29 @@ uint8_t limits_get_state_hardlimits()
 // homing cycles and will not respond correctly. Upon user request or need, there may be a
 // special pinout for an e-stop, but it is generally recommended to just directly connect
 // your e-stop switch to the Arduino reset pin, since it is the most correct way to do this.
-#ifndef ENABLE_SOFTWARE_DEBOUNCE
+#if !defined(LIMIT_INT_vect)
+  // Limit pins without a pin change interrupt. The watchdog timer interrupt polls the hard limit
+  // switches every ~16msec while the steppers run, so the stepper ISR does not have to on every
+  // step. With ENABLE_SOFTWARE_DEBOUNCE, a switch has to read engaged on two polls in a row. The
+  // engaged switches are left in sys.hard_limit_trigger_flag for the alarm report.
+  ISR(WDT_vect) // Watchdog timer ISR
+  {
+    if (!(sys.state & (STATE_CYCLE|STATE_HOLD|STATE_MOTION_CANCEL|STATE_SAFETY_DOOR))) { return; }
+    if (sys.calibration || sys_rt_exec_alarm) { return; }
+    uint8_t limit_state = limits_get_state_hardlimits();
+    #ifdef ENABLE_SOFTWARE_DEBOUNCE
+      static uint8_t last_limit_state = 0;
+      uint8_t engaged = limit_state & last_limit_state;
+      last_limit_state = limit_state;
+      limit_state = engaged;
+    #endif
+    if (limit_state) {
+      sys.hard_limit_trigger_flag = limit_state;
+      mc_reset(); // Initiate system kill.
+      bit_true_atomic(sys_rt_exec_alarm, (EXEC_ALARM_HARD_LIMIT|EXEC_CRITICAL_EVENT)); // Indicate hard limit critical event
+    }
+  }
+#elif !defined(ENABLE_SOFTWARE_DEBOUNCE)
   ISR(LIMIT_INT_vect) // DEFAULT: Limit pin change interrupt process. 
   {
     // Ignore limit switches if already in an alarm state or in-process of executing an alarm.
@@ -236,11 +277,15 @@ void limits_go_home(uint8_t cycle_mask)
     plan_sync_position(); // Sync planner position to current machine position.
     
     // Perform homing cycle. Planner buffer should be empty, as required to initiate the homing cycle.
-    #ifdef USE_LINE_NUMBERS
-      plan_buffer_line(target, homing_rate, false, HOMING_CYCLE_LINE_NUMBER); // Bypass mc_line(). Directly plan homing motion.
-    #else
-      plan_buffer_line(target, homing_rate, false ,false); 
-    #endif
+    // A search longer than MAX_BLOCK_STEPS is queued as several blocks, as far as the buffer holds them.
+    float block_target[N_AXIS];
+    while (plan_next_block_target(target, block_target) && !plan_check_full_buffer()) {
+      #ifdef USE_LINE_NUMBERS
+        plan_buffer_line(block_target, homing_rate, false, HOMING_CYCLE_LINE_NUMBER); // Bypass mc_line(). Directly plan homing motion.
+      #else
+        plan_buffer_line(block_target, homing_rate, false); 
+      #endif
+    }
     
     st_prep_buffer(); // Prep and fill segment buffer from newly planned block.
     st_wake_up(); // Initiate motion
@@ -94,6 +94,7 @@ int main(void)
     limits_init(); 
     probe_init();
     plan_reset(); // Clear block buffer and planner variables
+    mc_cartesian_reset(); // Drop any Cartesian line still being streamed.
     st_reset(); // Clear stepper subsystem variables.
 
     // Sync cleared gcode and planner positions to current system position.
@@ -23,6 +23,82 @@
 #include "grbl.h"
 
 
+// Cartesian line being streamed into the planner, see mc_line_cartesian().
+static struct {
+  cartesian_line_t line;
+  uint8_t active;            // Chords of the line are still to be queued
+  uint8_t emitting;          // mc_line() call is one of the line's own chords
+  float feed_rate;           // Cartesian feed rate, or negative for rapids
+  uint8_t invert_feed_rate;
+  float d_axis;              // D axis target, held along the line
+  float blend;               // G64 P tolerance to round the corner with the next line, 0 for G61
+  uint8_t chords;            // Chords kept by the check of the line still in the chord ring
+  float chord_t;             // Line fraction the last of those chords that was passed ends at
+} mc_cartesian;
+
+
+// Joint solutions of the chords of checked Cartesian lines and arcs, so a move is solved once, by its
+// check, and the streamer queues the kept chords. A ring like the planner buffer: the check stores
+// past the head, and the move takes its chords in when it executes, so a block failing after its
+// check leaves nothing behind. Chords of a move past a full ring are solved again while it streams.
+typedef struct {
+  float t;         // Fraction of the move the chord ends at
+  joint_t joint;   // Joint angles there
+} mc_chord_t;
+static struct {
+  mc_chord_t chord[CARTESIAN_CHORD_BUFFER_SIZE];
+  uint8_t tail;    // Oldest chord of the moves streaming
+  uint8_t head;    // End of the chords of the moves streaming
+  uint8_t store;   // End of the chords stored by the running check
+} mc_chords;
+
+
+static uint8_t mc_chord_next_index(uint8_t index)
+{
+  index++;
+  if (index == CARTESIAN_CHORD_BUFFER_SIZE) { index = 0; }
+  return(index);
+}
+
+
+// Starts a check. Drops the chords of a previous check whose block never executed.
+void mc_cartesian_check_begin()
+{
+  mc_chords.store = mc_chords.head;
+}
+
+
+// Stores the chord a Cartesian line or arc being checked has just advanced by, if the ring has room.
+void mc_cartesian_keep(cartesian_line_t *line)
+{
+  uint8_t next = mc_chord_next_index(mc_chords.store);
+  if (next == mc_chords.tail) { return; } // Full
+  mc_chords.chord[mc_chords.store].t = line->t;
+  memcpy(&mc_chords.chord[mc_chords.store].joint, &line->joint, sizeof(joint_t));
+  mc_chords.store = next;
+}
+
+
+// Hands the chords stored by the last check to its move, which is executing. Returns their number.
+static uint8_t mc_chord_commit()
+{
+  uint8_t count = 0;
+  while (mc_chords.head != mc_chords.store) {
+    mc_chords.head = mc_chord_next_index(mc_chords.head);
+    count++;
+  }
+  return(count);
+}
+
+
+// Drops the oldest kept chord of a move with 'count' chords left.
+static void mc_chord_drop(uint8_t *count)
+{
+  mc_chords.tail = mc_chord_next_index(mc_chords.tail);
+  (*count)--;
+}
+
+
 // Execute linear motion in absolute millimeter coordinates. Feed rate given in millimeters/second
 // unless invert_feed_rate is true. Then the feed_rate means that the motion should be completed in
 // (1 minute)/feed_rate time.
@@ -33,9 +109,11 @@
 #ifdef USE_LINE_NUMBERS
   void mc_line(float *target, float feed_rate, uint8_t invert_feed_rate, int32_t line_number)
 #else
-  void mc_line(float *target, float feed_rate, uint8_t invert_feed_rate, bool Compensation)
+  void mc_line(float *target, float feed_rate, uint8_t invert_feed_rate)
 #endif
 {
+  // A motion queued behind a Cartesian line still being streamed has to wait for the rest of it.
+  if (mc_cartesian.active && !mc_cartesian.emitting) { mc_cartesian_flush(); }
 	
 	//printString("in mc_line\r\n");
   // If enabled, check for soft limit violations. Placed here all line motions are picked up
@@ -85,37 +163,327 @@
   // If in check gcode mode, prevent motion by blocking planner. Soft limits still work.
   if (sys.state == STATE_CHECK_MODE) { return; }
     
-  // NOTE: Backlash compensation may be installed here. It will need direction info to track when
-  // to insert a backlash line motion(s) before the intended line motion and will require its own
-  // plan_check_full_buffer() and check for system abort loop. Also for position reporting 
-  // backlash steps will need to be also tracked, which will need to be kept at a system level.
-  // There are likely some other things that will need to be tracked as well. However, we feel
-  // that backlash compensation should NOT be handled by Grbl itself, because there are a myriad
-  // of ways to implement it and can be effective or ineffective for different CNC machines. This
-  // would be better handled by the interface as a post-processor task, where the original g-code
-  // is translated and inserts backlash motions that best suits the machine. 
-  // NOTE: Perhaps as a middle-ground, all that needs to be sent is a flag or special command that
-  // indicates to Grbl what is a backlash compensation motion, so that Grbl executes the move but
-  // doesn't update the machine position values. Since the position values used by the g-code
-  // parser and planner are separate from the system machine positions, this is doable.
-
-  // If the buffer is full: good! That means we are well ahead of the robot. 
-  // Remain in this loop until there is room in the buffer.
-  do {
-    protocol_execute_realtime(); // Check for any run-time commands
-    if (sys.abort) { return; } // Bail, if system abort.
-    if ( plan_check_full_buffer() ) { protocol_auto_cycle_start(); } // Auto-cycle start when buffer is full.
-    else { break; }
-  } while (1);
+  // NOTE: Backlash ($160-$166) is not handled here. The planner folds the take-up steps of a reversing
+  // axis into the line's own block and the stepper keeps them out of the machine position.
+
+  // A line longer than MAX_BLOCK_STEPS on an axis is queued as several blocks. In inverse time mode,
+  // each of them takes its share of the line time.
+  float block_target[N_AXIS];
+  uint16_t n_blocks = plan_next_block_target(target, block_target);
+  if (invert_feed_rate) { feed_rate *= n_blocks; }
+  while (n_blocks) {
+    // If the buffer is full: good! That means we are well ahead of the robot. 
+    // Remain in this loop until there is room in the buffer.
+    do {
+      protocol_execute_realtime(); // Check for any run-time commands
+      if (sys.abort) { return; } // Bail, if system abort.
+      if ( plan_check_full_buffer() ) { protocol_auto_cycle_start(); } // Auto-cycle start when buffer is full.
+      else { break; }
+    } while (1);
+
+    // Plan and queue motion into planner buffer
+    #ifdef USE_LINE_NUMBERS
+      plan_buffer_line(block_target, feed_rate, invert_feed_rate, line_number);
+    #else
+      plan_buffer_line(block_target, feed_rate, invert_feed_rate);
+    #endif
+    n_blocks = plan_next_block_target(target, block_target);
+  }
+}
+
+
+// Tool point travel of a Cartesian line in mm, and its unit vector if 'unit_vec' is given.
+static float mc_tool_length(cartesian_line_t *line, float *unit_vec)
+{
+  float delta[3];
+  uint8_t idx;
+  for (idx=X_Cartesian; idx<=Z_Cartesian; idx++) { delta[idx] = line->target.coord[idx] - line->start.coord[idx]; }
+  float length = sqrt(delta[0]*delta[0] + delta[1]*delta[1] + delta[2]*delta[2]);
+  if (unit_vec && (length > 0)) {
+    for (idx=0; idx<3; idx++) { unit_vec[idx] = delta[idx]/length; }
+  }
+  return(length);
+}
+
+
+// Queues a joint move of the streamed line that moves the tool point by 'tool_delta', at an inverse
+// time 'rate', or at rapids if 'rate' is negative. Waits in mc_line() if the planner is full.
+static void mc_cartesian_queue(float *position, float *tool_delta, float rate)
+{
+  mc_cartesian.emitting = true;
+  plan_set_tool_move(tool_delta);
+  mc_line(position, rate, (rate >= 0));
+  plan_set_tool_move(NULL);
+  mc_cartesian.emitting = false;
+}
+
+
+// Ends the streamed Cartesian line, with the kept chords it did not use.
+static void mc_cartesian_finish()
+{
+  mc_cartesian.active = false;
+  while (mc_cartesian.chords) { mc_chord_drop(&mc_cartesian.chords); }
+}
+
+
+// Advances the streamed line by one chord. Takes the next chord kept by the check of the line when the
+// line is at its start. Otherwise, as around a G64 blend, solves a chord that ends at most there.
+static uint8_t mc_cartesian_next(cartesian_line_t *line)
+{
+  mc_chord_t *chord = &mc_chords.chord[mc_chords.tail];
+  while (mc_cartesian.chords && (chord->t <= line->t)) {
+    mc_cartesian.chord_t = chord->t;
+    mc_chord_drop(&mc_cartesian.chords);
+    chord = &mc_chords.chord[mc_chords.tail];
+  }
+  if (!mc_cartesian.chords) { return(cartesian_line_next(line)); }
+  if ((mc_cartesian.chord_t == line->t) && (chord->t <= line->end)) {
+    line->dt = chord->t - line->t;
+    line->t = chord->t;
+    memcpy(&line->joint, &chord->joint, sizeof(joint_t));
+    return(STATUS_OK);
+  }
+  float end = line->end;
+  line->end = min(end, chord->t);
+  uint8_t status = cartesian_line_next(line);
+  line->end = end;
+  return(status);
+}
+
+
+// Queues the next chord of the streamed Cartesian line. Waits in mc_line() if the planner is full.
+static void mc_cartesian_emit()
+{
+  if (sys.abort || mc_cartesian_next(&mc_cartesian.line)) { // Never queue a stale target.
+    mc_cartesian_finish();
+    return;
+  }
+  cartesian_line_t *line = &mc_cartesian.line;
+  float *position = line->joint.angle;
+  position[D_AXIS] = mc_cartesian.d_axis;
+  float tool_delta[3];
+  uint8_t idx;
+  for (idx=X_Cartesian; idx<=Z_Cartesian; idx++) {
+    tool_delta[idx] = (line->target.coord[idx]-line->start.coord[idx])*line->dt;
+  }
+  if (mc_cartesian.feed_rate < 0) {
+    mc_cartesian_queue(position, tool_delta, -1.0);
+  } else {
+    mc_cartesian_queue(position, tool_delta, cartesian_line_feed(line, mc_cartesian.feed_rate, mc_cartesian.invert_feed_rate));
+  }
+  if (line->t >= 1.0) { mc_cartesian_finish(); }
+}
+
+
+// Rounds the corner between the held streamed line and the line 'next' with a circular blend that
+// deviates at most mc_cartesian.blend from the corner. The blend is tangent to both lines, shortens
+// the held line and 'next' by the same length, and is traced by IK point by point with arc_tolerance
+// chords like an arc, at the feed of 'next' and with the orientation of the corner. Returns false,
+// after finishing the held line, if the corner is left sharp: too flat or too sharp a corner, a
+// reorientation-only line, or a blend point without an IK solution. Otherwise 'next' is left
+// starting where the blend ends.
+static uint8_t mc_cartesian_blend(cartesian_line_t *next, float feed_rate, uint8_t invert_feed_rate, float d_axis)
+{
+  cartesian_line_t *line = &mc_cartesian.line;
+  float u1[3], u2[3];
+  float length1 = mc_tool_length(line, u1);
+  float length2 = mc_tool_length(next, u2);
+  if ((length1 == 0) || (length2 == 0)) { return(false); }
+  float cos_theta = u1[0]*u2[0] + u1[1]*u2[1] + u1[2]*u2[2];
+  float theta = acos(max(-1.0, min(1.0, cos_theta))); // Change of direction at the corner
+  if ((theta < CARTESIAN_BLEND_MIN_ANGLE) || (theta > (M_PI-CARTESIAN_BLEND_MIN_ANGLE))) { return(false); }
+  
+  // Tangent length d from the corner to either end of the blend, for a corner deviation of 'blend':
+  // R*(1/cos(theta/2)-1) == blend and d == R*tan(theta/2). Capped by what is left of the held line
+  // and half of the next line, which keeps its other half for the next corner.
+  float d = mc_cartesian.blend/tan(0.25*theta);
+  d = min(d, min((1.0-line->t)*length1, 0.5*length2));
+  float radius = d/tan(0.5*theta);
+  
+  // Run the held line up to the start of the blend.
+  line->end = 1.0-d/length1;
+  while (mc_cartesian.active && (line->t < line->end)) { mc_cartesian_emit(); }
+  if (!mc_cartesian.active) { return(false); } // Aborted.
+  
+  // Blend points: center + radius*(u1*sin(phi) - n*cos(phi)), n the unit normal from the corner toward
+  // the center, phi from 0 at the blend start to theta at the blend end.
+  float center[3], n[3];
+  uint8_t idx;
+  for (idx=0; idx<3; idx++) {
+    n[idx] = (u2[idx] - cos_theta*u1[idx])/sin(theta);
+    center[idx] = line->target.coord[idx] - d*u1[idx] + radius*n[idx];
+  }
+  uint16_t segments = 0;
+  if (radius > settings.arc_tolerance) {
+    segments = floor(0.5*theta*radius/sqrt(settings.arc_tolerance*(2*radius - settings.arc_tolerance)));
+  }
+  segments++;
+
+  pose_t blend_start, blend_end;
+  memcpy(&blend_start, &line->target, sizeof(pose_t));
+  memcpy(&blend_end, &line->target, sizeof(pose_t));
+  for (idx=0; idx<3; idx++) {
+    blend_start.coord[idx] -= d*u1[idx];
+    blend_end.coord[idx] += d*u2[idx];
+  }
+  float rate = -1.0;
+  if (feed_rate >= 0) {
+    rate = feed_rate*segments/(radius*theta);
+    if (invert_feed_rate) { rate *= length2; }
+  }
+  
+  // Solve every point before queueing any, so a blend leaving the workspace falls back to the corner.
+  cartesian_line_t blend;
+  float position[3], tool[3], tool_delta[3];
+  uint8_t pass;
+  uint16_t i;
+  for (pass=0; pass<2; pass++) {
+    cartesian_line_init(&blend, &blend_start, &blend_end, line->joint.angle, next->config);
+    memcpy(tool, blend_start.coord, sizeof(tool));
+    for (i=1; i<=segments; i++) {
+      float phi = theta*i/segments;
+      for (idx=0; idx<3; idx++) { 
+        position[idx] = center[idx] + radius*(u1[idx]*sin(phi) - n[idx]*cos(phi));
+        if (i == segments) { position[idx] = blend_end.coord[idx]; }
+      }
+      if (cartesian_line_solve(&blend, (float)i/segments, position)) { 
+        mc_cartesian_flush(); 
+        return(false);
+      }
+      if (pass) {
+        for (idx=0; idx<3; idx++) {
+          tool_delta[idx] = position[idx]-tool[idx];
+          tool[idx] = position[idx];
+        }
+        blend.joint.angle[D_AXIS] = d_axis;
+        mc_cartesian_queue(blend.joint.angle, tool_delta, rate);
+        if (sys.abort) { return(false); }
+      }
+    }
+  }
+  
+  // The held line is done. The next one starts at the end of the blend.
+  mc_cartesian_finish();
+  next->t = d/length2;
+  next->dt = next->t;
+  memcpy(next->joint.angle, blend.joint.angle, sizeof(next->joint.angle));
+  return(true);
+}
+
+
+// Starts a Cartesian (M20) G0/G1 line from 'start' to 'target', with the arm at joint angles 'angle'
+// at the start. The line is handed out as IK chords by mc_cartesian_execute() as planner blocks free
+// up, from the main loop, so the parser can acknowledge this line and parse the next one while
+// the chords of this one are still being generated. The line must already have been checked, see
+// gc_check_cartesian_line(), and takes the chords kept by the check. A negative feed_rate runs the
+// chords at rapids. With a G64 'blend' tolerance, the end of the line is held back until the next
+// line shows whether its corner can be rounded, see mc_cartesian_blend(), or no next line is
+// waiting, see mc_cartesian_release().
+void mc_line_cartesian(pose_t *start, pose_t *target, float *angle, uint8_t config, float feed_rate,
+                       uint8_t invert_feed_rate, float d_axis, float blend)
+{
+  cartesian_line_t next;
+  cartesian_line_init(&next, start, target, angle, config);
+  uint8_t chords = mc_chord_commit();
+  if (mc_cartesian.active) { // Keep lines in order.
+    if (!((mc_cartesian.blend > 0) && mc_cartesian_blend(&next, feed_rate, invert_feed_rate, d_axis))) {
+      mc_cartesian_flush(); 
+    }
+  }
+  mc_cartesian_finish(); // Drops the chords of a line ended by an abort.
+  memcpy(&mc_cartesian.line, &next, sizeof(next));
+  mc_cartesian.chords = chords;
+  mc_cartesian.chord_t = 0.0;
+  mc_cartesian.feed_rate = feed_rate;
+  mc_cartesian.invert_feed_rate = invert_feed_rate;
+  mc_cartesian.d_axis = d_axis;
+  mc_cartesian.blend = blend;
+  if (blend > 0) {
+    float length = mc_tool_length(&mc_cartesian.line, NULL);
+    if (length > 0) {
+      mc_cartesian.line.end = max(0.5, 1.0 - blend/(tan(0.25*CARTESIAN_BLEND_MIN_ANGLE)*length));
+    }
+  }
+  mc_cartesian.active = true;
+  mc_cartesian_execute();
+}
+
+
+// Queues chords of the streamed Cartesian line while the planner has room. Never waits. Called
+// from the main loop.
+void mc_cartesian_execute()
+{
+  cartesian_line_t *line = &mc_cartesian.line;
+  while (mc_cartesian.active && (line->t < line->end) && !plan_check_full_buffer()) { mc_cartesian_emit(); }
+}
+
+
+// Releases the end a G64 line holds back for a blend. Called from the main loop when no next line is
+// waiting, so the planner never plans the line to stop at its hold point and crawl through the rest.
+void mc_cartesian_release()
+{
+  mc_cartesian.line.end = 1.0;
+}
+
+
+// Queues the rest of the streamed Cartesian line, waiting for planner room as mc_line() does.
+void mc_cartesian_flush()
+{
+  mc_cartesian.line.end = 1.0;
+  while (mc_cartesian.active) { mc_cartesian_emit(); }
+}
 
 
+// Drops the streamed Cartesian line and the kept chords. Called upon a system abort, with the planner.
+void mc_cartesian_reset()
+{
+  mc_cartesian.active = false;
+  mc_cartesian.emitting = false;
+  mc_cartesian.chords = 0;
+  memset(&mc_chords, 0, sizeof(mc_chords));
+}
+
+
+// Tool point of the last queued point of a Cartesian arc, and the chords its check kept left.
+static float mc_arc_tool[3];
+static uint8_t mc_arc_chords;
+
 
-  // Plan and queue motion into planner buffer
+// Queues one point of an arc traced by mc_arc_trace(), solving it first if the arc is Cartesian.
+static uint8_t mc_arc_point(float *position, float fraction, float feed_rate, uint8_t invert_feed_rate,
+  int32_t line_number, cartesian_line_t *kin, uint8_t check)
+{
+  if (kin) {
+    mc_chord_t *chord = &mc_chords.chord[mc_chords.tail];
+    if (mc_arc_chords && (chord->t == fraction)) {
+      kin->dt = fraction-kin->t;
+      kin->t = fraction;
+      memcpy(&kin->joint, &chord->joint, sizeof(joint_t));
+      mc_chord_drop(&mc_arc_chords);
+    } else {
+      uint8_t status = cartesian_line_solve(kin, fraction, position);
+      if (status) { return(status); }
+      if (check) { 
+        mc_cartesian_keep(kin);
+        return(STATUS_OK);
+      }
+    }
+    float tool_delta[3];
+    uint8_t idx;
+    for (idx=X_Cartesian; idx<=Z_Cartesian; idx++) {
+      tool_delta[idx] = position[idx]-mc_arc_tool[idx];
+      mc_arc_tool[idx] = position[idx];
+    }
+    plan_set_tool_move(tool_delta);
+    position = kin->joint.angle;
+  }
   #ifdef USE_LINE_NUMBERS
-    plan_buffer_line(target, feed_rate, invert_feed_rate, line_number);
+    mc_line(position, feed_rate, invert_feed_rate, line_number);
   #else
-    plan_buffer_line(target, feed_rate, invert_feed_rate, Compensation);
+    mc_line(position, feed_rate, invert_feed_rate);
   #endif
+  plan_set_tool_move(NULL);
+  return(STATUS_OK);
 }
 
 
@@ -126,13 +494,13 @@
 // The arc is approximated by generating a huge number of tiny, linear segments. The chordal tolerance
 // of each segment is configured in settings.arc_tolerance, which is defined to be the maximum normal
 // distance from segment to the circle when the end points both lie on the circle.
-#ifdef USE_LINE_NUMBERS
-  void mc_arc(float *position, float *target, float *offset, float radius, float feed_rate, 
-    uint8_t invert_feed_rate, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc, int32_t line_number)
-#else
-  void mc_arc(float *position, float *target, float *offset, float radius, float feed_rate,
-    uint8_t invert_feed_rate, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc)
-#endif
+// With a Cartesian line 'kin', the arc is traced in Cartesian space instead: position, target and
+// offset are indexed by X_Cartesian..RZ_Cartesian, every arc point is solved by IK with the
+// orientation 'kin' has at that fraction of the arc, and the joint angles are queued. With 'check'
+// set, the points are only solved and kept, see mc_cartesian_keep(). Returns the first IK failure.
+static uint8_t mc_arc_trace(float *position, float *target, float *offset, float radius, float feed_rate,
+  uint8_t invert_feed_rate, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc,
+  int32_t line_number, cartesian_line_t *kin, uint8_t check)
 {
   float center_axis0 = position[axis_0] + offset[axis_0];
   float center_axis1 = position[axis_1] + offset[axis_1];
@@ -156,6 +524,13 @@
   uint16_t segments = floor(fabs(0.5*angular_travel*radius)/
                           sqrt(settings.arc_tolerance*(2*radius - settings.arc_tolerance)) );
   
+  // Joint moves of a Cartesian arc are timed by the Cartesian arc length, so run them in inverse time.
+  if (kin && !invert_feed_rate) {
+    feed_rate /= hypot_f(angular_travel*radius, target[axis_linear]-position[axis_linear]);
+    invert_feed_rate = true;
+  }
+
+  uint8_t status;
   if (segments) { 
     // Multiply inverse feed_rate to compensate for the fact that this movement is approximated
     // by a number of discrete segments. The inverse feed_rate should be correct for the sum of 
@@ -224,39 +599,92 @@
       position[axis_1] = center_axis1 + r_axis1;
       position[axis_linear] += linear_per_segment;
       
-      #ifdef USE_LINE_NUMBERS
-        mc_line(position, feed_rate, invert_feed_rate, line_number);
-      #else
-        mc_line(position, feed_rate, invert_feed_rate, false);
-      #endif
+      status = mc_arc_point(position, (float)i/segments, feed_rate, invert_feed_rate, line_number, kin, check);
+      if (status) { return(status); }
       
       // Bail mid-circle on system abort. Runtime command check already performed by mc_line.
-      if (sys.abort) { return; }
+      if (sys.abort) { return(STATUS_OK); }
     }
   }
   // Ensure last segment arrives at target location.
-  #ifdef USE_LINE_NUMBERS
-    mc_line(target, feed_rate, invert_feed_rate, line_number);
-  #else
-    mc_line(target, feed_rate, invert_feed_rate, false);
-  #endif
+  return(mc_arc_point(target, 1.0, feed_rate, invert_feed_rate, line_number, kin, check));
+}
+
+
+#ifdef USE_LINE_NUMBERS
+  void mc_arc(float *position, float *target, float *offset, float radius, float feed_rate, 
+    uint8_t invert_feed_rate, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc, int32_t line_number)
+  {
+    mc_arc_trace(position, target, offset, radius, feed_rate, invert_feed_rate, axis_0, axis_1, axis_linear,
+      is_clockwise_arc, line_number, NULL, false);
+  }
+#else
+  void mc_arc(float *position, float *target, float *offset, float radius, float feed_rate,
+    uint8_t invert_feed_rate, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc)
+  {
+    mc_arc_trace(position, target, offset, radius, feed_rate, invert_feed_rate, axis_0, axis_1, axis_linear,
+      is_clockwise_arc, 0, NULL, false);
+  }
+#endif
+
+
+// Traces a Cartesian (M20) G2/G3 arc from 'start' to 'target' as mc_arc() does in joint space, with
+// offset, radius and plane axes in Cartesian terms (X_Cartesian..Z_Cartesian). The orientation turns
+// from the start to the target orientation along the arc. 'angle' holds the joint angles at the start,
+// and the joint angles at the end on return. With 'check' set, nothing is queued and the return value
+// tells whether every arc point has an IK solution. The arc then queues the joints its check solved.
+uint8_t mc_arc_cartesian(pose_t *start, pose_t *target, float *offset, float radius, float feed_rate,
+  uint8_t invert_feed_rate, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc,
+  float *angle, uint8_t config, float d_axis, uint8_t check)
+{
+  if (check) {
+    mc_cartesian_check_begin();
+    mc_arc_chords = 0;
+  } else {
+    mc_arc_chords = mc_chord_commit();
+    mc_cartesian_flush(); // Queue a streamed line first, it would take the arc's tool moves.
+  }
+  cartesian_line_t kin;
+  float position[N_Cartesian];
+  memcpy(position, start->coord, sizeof(position));
+  memcpy(mc_arc_tool, start->coord, sizeof(mc_arc_tool));
+  cartesian_line_init(&kin, start, target, angle, config);
+  kin.joint.angle[D_AXIS] = d_axis;
+  uint8_t status = mc_arc_trace(position, target->coord, offset, radius, feed_rate, invert_feed_rate, axis_0, 
+    axis_1, axis_linear, is_clockwise_arc, gc_state.line_number, &kin, check);
+  while (mc_arc_chords) { mc_chord_drop(&mc_arc_chords); }
+  memcpy(angle, kin.joint.angle, sizeof(kin.joint.angle));
+  return(status);
 }
 
 
 // Execute dwell in seconds.
+// The dwell is queued as a timed planner block, so parsing and planning go on while it runs. A
+// zero dwell, G4 P0, still waits for the motion to complete.
+#ifdef USE_LINE_NUMBERS
+void mc_dwell(float seconds, int32_t line_number) 
+#else
 void mc_dwell(float seconds) 
+#endif
 {
-   if (sys.state == STATE_CHECK_MODE) { return; }
-   
-   uint16_t i = floor(1000/DWELL_TIME_STEP*seconds);
-   protocol_buffer_synchronize();
-   delay_ms(floor(1000*seconds-i*DWELL_TIME_STEP)); // Delay millisecond remainder.
-   while (i-- > 0) {
-     // NOTE: Check and execute realtime commands during dwell every <= DWELL_TIME_STEP milliseconds.
-     protocol_execute_realtime();
-     if (sys.abort) { return; }
-     _delay_ms(DWELL_TIME_STEP); // Delay DWELL_TIME_STEP increment
-   }
+  if (sys.state == STATE_CHECK_MODE) { return; }
+  if (seconds <= 0.0) { 
+    protocol_buffer_synchronize();
+    return;
+  }
+
+  mc_cartesian_flush(); // The rest of a streamed Cartesian line comes first.
+  do {
+    protocol_execute_realtime(); // Check for any run-time commands
+    if (sys.abort) { return; } // Bail, if system abort.
+    if ( plan_check_full_buffer() ) { protocol_auto_cycle_start(); } // Auto-cycle start when buffer is full.
+    else { break; }
+  } while (1);
+  #ifdef USE_LINE_NUMBERS
+    plan_buffer_dwell(seconds, line_number);
+  #else
+    plan_buffer_dwell(seconds);
+  #endif
 }
 
 
@@ -368,7 +796,7 @@ void mc_homing_cycle()
   #ifdef USE_LINE_NUMBERS
     mc_line(target, feed_rate, invert_feed_rate, line_number);
   #else
-    mc_line(target, feed_rate, invert_feed_rate, false);
+    mc_line(target, feed_rate, invert_feed_rate);
   #endif
   
   // Activate the probing state monitor in the stepper module.
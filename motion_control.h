@@ -31,9 +31,30 @@
 #ifdef USE_LINE_NUMBERS
 void mc_line(float *target, float feed_rate, uint8_t invert_feed_rate, int32_t line_number);
 #else
-void mc_line(float *target, float feed_rate, uint8_t invert_feed_rate,bool Compensation);
+void mc_line(float *target, float feed_rate, uint8_t invert_feed_rate);
 #endif
 
+// Start streaming a Cartesian (M20) G0/G1 line into the planner as IK chords, G64 blended with the next one.
+void mc_line_cartesian(pose_t *start, pose_t *target, float *angle, uint8_t config, float feed_rate,
+                       uint8_t invert_feed_rate, float d_axis, float blend);
+
+// Queue chords of the streamed Cartesian line while the planner has room. Called from the main loop.
+void mc_cartesian_execute();
+
+// Release the end of the streamed Cartesian line held back for a G64 blend. Called from the main loop.
+void mc_cartesian_release();
+
+// Queue the rest of the streamed Cartesian line, waiting for planner room.
+void mc_cartesian_flush();
+
+// Drop the streamed Cartesian line upon a system abort.
+void mc_cartesian_reset();
+
+// Start checking a Cartesian line or arc, and keep the joints of each of its checked chords for its
+// execution, so it is not solved again.
+void mc_cartesian_check_begin();
+void mc_cartesian_keep(cartesian_line_t *line);
+
 // Execute an arc in offset mode format. position == current xyz, target == target xyz, 
 // offset == offset from current xyz, axis_XXX defines circle plane in tool space, axis_linear is
 // the direction of helical travel, radius == circle radius, is_clockwise_arc boolean. Used
@@ -45,9 +66,18 @@ void mc_arc(float *position, float *target, float *offset, float radius, float f
 void mc_arc(float *position, float *target, float *offset, float radius, float feed_rate,
   uint8_t invert_feed_rate, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc);
 #endif
+
+// Execute or, with check set, only verify a Cartesian (M20) arc. Offset and plane axes are Cartesian.
+uint8_t mc_arc_cartesian(pose_t *start, pose_t *target, float *offset, float radius, float feed_rate,
+  uint8_t invert_feed_rate, uint8_t axis_0, uint8_t axis_1, uint8_t axis_linear, uint8_t is_clockwise_arc,
+  float *angle, uint8_t config, float d_axis, uint8_t check);
   
 // Dwell for a specific number of seconds
+#ifdef USE_LINE_NUMBERS
+void mc_dwell(float seconds, int32_t line_number);
+#else
 void mc_dwell(float seconds);
+#endif
 
 // Perform homing cycle to locate machine zero. Requires limit switches.
 void mc_homing_cycle();
@@ -38,15 +38,19 @@ typedef struct {
                                      // i.e. arcs, canned cycles, and backlash compensation.
   float previous_unit_vec[N_AXIS];   // Unit vector of previous path line segment
   float previous_nominal_speed_sqr;  // Nominal speed of previous path line segment
+  float tool_move[3];                // Tool point travel of the next block, see plan_set_tool_move()
+  uint8_t tool_move_set;             // tool_move[] applies to the next block
+  float previous_tool_unit_vec[3];   // Tool point unit vector of previous block, if it had one
+  uint8_t previous_tool;             // Previous block was limited by its tool point travel
+  uint8_t backlash_direction_bits;   // Last direction moved by each axis, as in block direction_bits
+  uint8_t output_bits;               // Output changes for the next block, see plan_queue_output()
+  uint16_t output_pwm[N_OUTPUT];
+  #ifdef PLANNER_COALESCE_DEVIATION
+    float coalesce_deviation;        // Steps the newest block is off the segments merged into it
+  #endif
 } planner_t;
 static planner_t pl;
 
-int32_t get_pl(int axis)
-{
-	return pl.position[axis];
-}
-
-
 // Returns the index of the next block in the ring buffer. Also called by stepper segment buffer.
 uint8_t plan_next_block_index(uint8_t block_index) 
 {
@@ -203,9 +207,158 @@ static void planner_recalculate()
 }
 
 
+// Gives the tool point travel in mm of the next planned block, a chord of a Cartesian move, for the
+// Cartesian look-ahead in plan_buffer_line(). NULL clears it for blocks that are joint moves.
+void plan_set_tool_move(float *tool_delta)
+{
+  pl.tool_move_set = (tool_delta != NULL);
+  if (pl.tool_move_set) { memcpy(pl.tool_move, tool_delta, sizeof(pl.tool_move)); }
+}
+
+
+#ifdef PLANNER_COALESCE_DEVIATION
+// Merges the new block, with unit vector unit_vec, into the newest planner block, if that block is not
+// executing yet and the two fit into one block within PLANNER_COALESCE_DEVIATION and the speed and
+// acceleration tolerances. The segment end between them is off the merged line by the perpendicular
+// part of the newest block's travel, which adds to the deviation of the segments merged before it.
+// Updates pl.previous_unit_vec to the merged line. Returns true if the new block was merged.
+static uint8_t plan_coalesce_block(plan_block_t *block, float *unit_vec)
+{
+  if (block_buffer_head == block_buffer_tail) { return(false); }
+  uint8_t prev_index = plan_prev_block_index(block_buffer_head);
+  if (prev_index == block_buffer_tail) { return(false); } // May be executing.
+  plan_block_t *prev = &block_buffer[prev_index];
+  if ((prev->direction_bits != block->direction_bits) || prev->backlash_bits || block->backlash_bits) { return(false); }
+  if (block->output_bits) { return(false); } // Outputs change at the start of the block.
+  #ifdef USE_LINE_NUMBERS
+    if (prev->line_number != block->line_number) { return(false); }
+  #endif
+  if ((block->nominal_speed_sqr < prev->nominal_speed_sqr) ||
+      (block->nominal_speed_sqr > prev->nominal_speed_sqr*(1.0+PLANNER_COALESCE_TOLERANCE)*(1.0+PLANNER_COALESCE_TOLERANCE))) { return(false); }
+  if ((block->acceleration < prev->acceleration) ||
+      (block->acceleration > prev->acceleration*(1.0+PLANNER_COALESCE_TOLERANCE))) { return(false); }
+
+  // Travel of the newest block (prev_mm) and of the merged line (line_mm), in mm.
+  float prev_mm[N_AXIS], line_mm[N_AXIS];
+  float line_sqr = 0, prev_dot_line = 0;
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    if ((uint32_t)prev->steps[idx]+block->steps[idx] > MAX_BLOCK_STEPS) { return(false); }
+    prev_mm[idx] = prev->steps[idx]/settings.steps_per_mm[idx];
+    if (prev->direction_bits & get_direction_pin_mask(idx)) { prev_mm[idx] = -prev_mm[idx]; }
+    line_mm[idx] = prev_mm[idx] + unit_vec[idx]*block->millimeters;
+    line_sqr += line_mm[idx]*line_mm[idx];
+    prev_dot_line += prev_mm[idx]*line_mm[idx];
+  }
+  float fraction = prev_dot_line/line_sqr;
+  float deviation = 0;
+  for (idx=0; idx<N_AXIS; idx++) {
+    deviation = max(deviation, fabs(prev_mm[idx]-fraction*line_mm[idx])*settings.steps_per_mm[idx]);
+  }
+  deviation += pl.coalesce_deviation;
+  if (deviation > PLANNER_COALESCE_DEVIATION) { return(false); }
+
+  pl.coalesce_deviation = deviation;
+  for (idx=0; idx<N_AXIS; idx++) {
+    prev->steps[idx] += block->steps[idx];
+    prev->step_event_count = max(prev->step_event_count, prev->steps[idx]);
+  }
+  prev->millimeters = sqrt(line_sqr);
+  for (idx=0; idx<N_AXIS; idx++) { pl.previous_unit_vec[idx] = line_mm[idx]/prev->millimeters; }
+  return(true);
+}
+#endif
+
+
+// Returns the maximum junction speed^2 of a corner, given the cosine of its junction angle and the
+// acceleration of the centripetal arc through it. See the junction deviation notes in plan_buffer_line().
+// NOTE: Computed without any expensive trig, sin() or acos(), by trig half angle identity of cos(theta).
+static float plan_junction_speed_sqr(float junction_cos_theta, float junction_acceleration)
+{
+  if (junction_cos_theta > 0.999999) {
+    //  For a 0 degree acute junction, just set minimum junction speed. 
+    return(MINIMUM_JUNCTION_SPEED*MINIMUM_JUNCTION_SPEED);
+  }
+  junction_cos_theta = max(junction_cos_theta,-0.999999); // Check for numerical round-off to avoid divide by zero.
+  float sin_theta_d2 = sqrt(0.5*(1.0-junction_cos_theta)); // Trig half angle identity. Always positive.
+
+  // TODO: Technically, the acceleration used in calculation needs to be limited by the minimum of the
+  // two junctions. However, this shouldn't be a significant problem except in extreme circumstances.
+  return(max( MINIMUM_JUNCTION_SPEED*MINIMUM_JUNCTION_SPEED,
+              (junction_acceleration * settings.junction_deviation * sin_theta_d2)/(1.0-sin_theta_d2) ));
+}
+
+
+// Returns the number of take-up steps of the backlash setting of an axis, limited to the room left
+// above MAX_BLOCK_STEPS in the 16-bit block step counts.
+uint16_t plan_backlash_steps(uint8_t idx)
+{
+  return(min(lround(settings.backlash[idx]*settings.steps_per_mm[idx]), 0xFFFF-MAX_BLOCK_STEPS));
+}
+
+
+// Sets block_target to the end of the next block of a line from the planner position to target. A line
+// with more than MAX_BLOCK_STEPS steps on an axis is split into equal collinear blocks, which the planner
+// joins at full speed. Returns the number of blocks left to queue for the line, this one included, or
+// zero if the planner is already at the target.
+uint16_t plan_next_block_target(float *target, float *block_target)
+{
+  uint32_t max_steps = 0;
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    max_steps = max(max_steps, labs(lround(target[idx]*settings.steps_per_mm[idx])-pl.position[idx]));
+  }
+  #ifdef COREXY
+    max_steps *= 2; // A and B motor steps are up to the sum of the X and Y steps.
+  #endif
+  if (max_steps == 0) { return(0); }
+  uint16_t n_blocks = 1 + max_steps/MAX_BLOCK_STEPS;
+  if (n_blocks == 1) {
+    memcpy(block_target, target, sizeof(float)*N_AXIS);
+  } else {
+    for (idx=0; idx<N_AXIS; idx++) {
+      float position = pl.position[idx]/settings.steps_per_mm[idx];
+      block_target[idx] = position + (target[idx]-position)/n_blocks;
+    }
+  }
+  return(n_blocks);
+}
+
+
+// Output changes ride along with the next block and are applied by the stepper ISR as it loads the
+// block, so they take effect exactly where the motion before them ends without draining the buffer.
+void plan_queue_output(uint8_t output, uint16_t pwm)
+{
+  #ifdef LASER_DYNAMIC_POWER
+    if (output == OUTPUT_LASER_DYNAMIC) { 
+      pl.output_bits |= bit(OUTPUT_LASER_DYNAMIC);
+      output = OUTPUT_PUMP;
+    } else if (output == OUTPUT_PUMP) {
+      pl.output_bits &= ~bit(OUTPUT_LASER_DYNAMIC);
+    }
+  #endif
+  pl.output_bits |= bit(output);
+  pl.output_pwm[output] = pwm;
+}
+
+
+void plan_flush_outputs()
+{
+  if (pl.output_bits) {
+    spindle_apply_outputs(pl.output_bits, pl.output_pwm);
+    #ifdef LASER_DYNAMIC_POWER
+      st_update_laser_power(pl.output_bits, pl.output_pwm);
+    #endif
+    pl.output_bits = 0;
+  }
+}
+
+
 void plan_reset() 
 {
+  uint8_t backlash_direction_bits = pl.backlash_direction_bits; // The slack stays where the last move left it.
   memset(&pl, 0, sizeof(planner_t)); // Clear planner struct
+  pl.backlash_direction_bits = backlash_direction_bits;
   block_buffer_tail = 0;
   block_buffer_head = 0; // Empty = tail
   next_buffer_head = 1; // plan_next_block_index(block_buffer_head)
@@ -253,25 +406,25 @@ uint8_t plan_check_full_buffer()
    All position data passed to the planner must be in terms of machine position to keep the planner 
    independent of any coordinate system changes and offsets, which are handled by the g-code parser.
    NOTE: Assumes buffer is available. Buffer checks are handled at a higher level by motion_control.
-   In other words, the buffer head is never equal to the buffer tail.  Also the feed rate input value
+   In other words, the buffer head is never equal to the buffer tail. The target must also be within
+   MAX_BLOCK_STEPS of the planner position, see plan_next_block_target(). Also the feed rate input value
    is used in three ways: as a normal feed rate if invert_feed_rate is false, as inverse time if
    invert_feed_rate is true, or as seek/rapids rate if the feed_rate value is negative (and
    invert_feed_rate always false). */
 #ifdef USE_LINE_NUMBERS   
   void plan_buffer_line(float *target, float feed_rate, uint8_t invert_feed_rate, int32_t line_number) 
 #else
-  void plan_buffer_line(float *target, float feed_rate, uint8_t invert_feed_rate ,bool Compensation) 
+  void plan_buffer_line(float *target, float feed_rate, uint8_t invert_feed_rate) 
 #endif
 {
-//  printString("in plan_buffer_line %d\r\n");
-  if(Compensation)
-		printString("\r\nin compensation plan_buffer_line\r\n");
-
   // Prepare and initialize new block
   plan_block_t *block = &block_buffer[block_buffer_head];
   block->step_event_count = 0;
   block->millimeters = 0;
   block->direction_bits = 0;
+  block->backlash_bits = 0;
+  block->output_bits = pl.output_bits;
+  memcpy(block->output_pwm, pl.output_pwm, sizeof(pl.output_pwm));
   block->acceleration = SOME_LARGE_VALUE; // Scaled down to maximum acceleration later
   #ifdef USE_LINE_NUMBERS
     block->line_number = line_number;
@@ -327,6 +480,26 @@ uint8_t plan_check_full_buffer()
   
   // Bail if this is a zero-length block. Highly unlikely to occur.
   if (block->step_event_count == 0) { return; } 
+
+  // Backlash compensation. An axis reversing its direction first takes up its $16x backlash. The
+  // take-up steps are added to the axis steps of this block rather than queued as a motion of their
+  // own, so the stepper traces them together with the move, and only the steps past them count
+  // towards the machine position. Homing only tracks the direction, leaving the slack on its known side.
+  for (idx=0; idx<N_AXIS; idx++) {
+    if (block->steps[idx] == 0) { continue; }
+    uint8_t direction_mask = get_direction_pin_mask(idx);
+    if ((block->direction_bits ^ pl.backlash_direction_bits) & direction_mask) {
+      pl.backlash_direction_bits ^= direction_mask;
+      if ((sys.state != STATE_HOMING) && (settings.backlash[idx] > 0)) {
+        uint16_t backlash_steps = plan_backlash_steps(idx);
+        if (backlash_steps) {
+          block->steps[idx] += backlash_steps;
+          block->step_event_count = max(block->step_event_count, block->steps[idx]);
+          block->backlash_bits |= bit(idx);
+        }
+      }
+    }
+  }
   
   // Adjust feed_rate value to mm/min depending on type of rate input (normal, inverse time, or rapids)
   // TODO: Need to distinguish a rapids vs feed move for overrides. Some flag of some sort.
@@ -345,6 +518,9 @@ uint8_t plan_check_full_buffer()
     if (unit_vec[idx] != 0) {  // Avoid divide by zero.
       unit_vec[idx] *= inverse_millimeters;  // Complete unit vector calculation
       inverse_unit_vec_value = fabs(1.0/unit_vec[idx]); // Inverse to remove multiple float divides.
+      if (block->backlash_bits & bit(idx)) { // The axis covers its take-up on top of its share of the line.
+        inverse_unit_vec_value = block->millimeters*settings.steps_per_mm[idx]/block->steps[idx];
+      }
 
       // Check and limit feed rate against max individual axis velocities and accelerations
       feed_rate = min(feed_rate,settings.max_rate[idx]*inverse_unit_vec_value);
@@ -357,12 +533,35 @@ uint8_t plan_check_full_buffer()
     }
   }
   
+  // Cartesian look-ahead. A chord of an M20 move is also planned by its tool point travel: acceleration
+  // is capped to $47 at the tool, and the junction with a previous chord is limited by the tool path
+  // corner as well as the joint-space corner. Joint speed along a chord is joint_per_tool times the
+  // tool speed.
+  float tool_unit_vec[3];
+  float tool_cos_theta = 0;
+  float joint_per_tool = 0;
+  uint8_t tool_move = false;
+  if (pl.tool_move_set && (settings.robot_qinnew.tool_acceleration > 0)) {
+    float tool_millimeters = sqrt(pl.tool_move[0]*pl.tool_move[0] + pl.tool_move[1]*pl.tool_move[1] + 
+                                  pl.tool_move[2]*pl.tool_move[2]);
+    if (tool_millimeters > 0) { // Pure reorientations are left to the joint planner.
+      joint_per_tool = block->millimeters/tool_millimeters;
+      block->acceleration = min(block->acceleration, settings.robot_qinnew.tool_acceleration*joint_per_tool);
+      for (idx=0; idx<3; idx++) {
+        tool_unit_vec[idx] = pl.tool_move[idx]/tool_millimeters;
+        tool_cos_theta -= pl.previous_tool_unit_vec[idx] * tool_unit_vec[idx];
+      }
+      tool_move = true;
+    }
+  }
+
   // TODO: Need to check this method handling zero junction speeds when starting from rest.
+  float max_junction_speed_sqr; // Junction entry speed limit based on direction vectors in (mm/min)^2
   if (block_buffer_head == block_buffer_tail) {
   
     // Initialize block entry speed as zero. Assume it will be starting from rest. Planner will correct this later.
     block->entry_speed_sqr = 0.0;
-    block->max_junction_speed_sqr = 0.0; // Starting from rest. Enforce start from zero velocity.
+    max_junction_speed_sqr = 0.0; // Starting from rest. Enforce start from zero velocity.
   
   } else {
     /* 
@@ -388,19 +587,13 @@ uint8_t plan_check_full_buffer()
        memory in the event of a feedrate override changing the nominal speeds of blocks, which can 
        change the overall maximum entry speed conditions of all blocks.
     */
-    // NOTE: Computed without any expensive trig, sin() or acos(), by trig half angle identity of cos(theta).
-    if (junction_cos_theta > 0.999999) {
-      //  For a 0 degree acute junction, just set minimum junction speed. 
-      block->max_junction_speed_sqr = MINIMUM_JUNCTION_SPEED*MINIMUM_JUNCTION_SPEED;
-    } else {
-      junction_cos_theta = max(junction_cos_theta,-0.999999); // Check for numerical round-off to avoid divide by zero.
-      float sin_theta_d2 = sqrt(0.5*(1.0-junction_cos_theta)); // Trig half angle identity. Always positive.
-
-      // TODO: Technically, the acceleration used in calculation needs to be limited by the minimum of the
-      // two junctions. However, this shouldn't be a significant problem except in extreme circumstances.
-      block->max_junction_speed_sqr = max( MINIMUM_JUNCTION_SPEED*MINIMUM_JUNCTION_SPEED,
-                                   (block->acceleration * settings.junction_deviation * sin_theta_d2)/(1.0-sin_theta_d2) );
-
+    max_junction_speed_sqr = plan_junction_speed_sqr(junction_cos_theta, block->acceleration);
+    
+    // The tool path corner of two chords can only tighten the joint-space limit. Its speed^2 at tool
+    // acceleration block->acceleration/joint_per_tool, times joint_per_tool^2.
+    if (tool_move && pl.previous_tool) {
+      max_junction_speed_sqr = min(max_junction_speed_sqr,
+                                   plan_junction_speed_sqr(tool_cos_theta, block->acceleration*joint_per_tool));
     }
   }
 
@@ -408,17 +601,29 @@ uint8_t plan_check_full_buffer()
   block->nominal_speed_sqr = feed_rate*feed_rate; // (mm/min). Always > 0
   
   // Compute the junction maximum entry based on the minimum of the junction speed and neighboring nominal speeds.
-  block->max_entry_speed_sqr = min(block->max_junction_speed_sqr, 
+  block->max_entry_speed_sqr = min(max_junction_speed_sqr, 
                                    min(block->nominal_speed_sqr,pl.previous_nominal_speed_sqr));
   
   // Update previous path unit_vector and nominal speed (squared)
+  pl.previous_tool = tool_move;
+  if (tool_move) { memcpy(pl.previous_tool_unit_vec, tool_unit_vec, sizeof(tool_unit_vec)); }
+  #ifdef PLANNER_COALESCE_DEVIATION
+    if (plan_coalesce_block(block, unit_vec)) {
+      // Merged into the newest block, which keeps its speeds. Only its length changed.
+      memcpy(pl.position, target_steps, sizeof(target_steps));
+      planner_recalculate();
+      return;
+    }
+    pl.coalesce_deviation = 0;
+  #endif
   memcpy(pl.previous_unit_vec, unit_vec, sizeof(unit_vec)); // pl.previous_unit_vec[] = unit_vec[]
   pl.previous_nominal_speed_sqr = block->nominal_speed_sqr;
     
   // Update planner position
-  if(!Compensation)
   memcpy(pl.position, target_steps, sizeof(target_steps)); // pl.position[] = target_steps[]
 
+  pl.output_bits = 0; // Taken along by the block.
+
   // New block is all set. Update buffer head and next buffer head indices.
   block_buffer_head = next_buffer_head;  
   next_buffer_head = plan_next_block_index(block_buffer_head);
@@ -428,6 +633,34 @@ uint8_t plan_check_full_buffer()
 }
 
 
+/* Add a dwell of the given time to the buffer, as a block without steps. Its millimeters hold the
+   dwell time left in minutes, which the stepper segment generator counts down in timed segments
+   without steps. The motion before a dwell comes to a full stop, and so does the motion after it
+   start from one. Unlike a synchronized dwell, the blocks behind it keep being planned and prepped
+   while it runs, and output changes queued before it take effect as it starts. */
+#ifdef USE_LINE_NUMBERS
+  void plan_buffer_dwell(float seconds, int32_t line_number)
+#else
+  void plan_buffer_dwell(float seconds)
+#endif
+{
+  plan_block_t *block = &block_buffer[block_buffer_head];
+  memset(block, 0, sizeof(plan_block_t)); // No steps. Zero speeds and acceleration.
+  block->millimeters = seconds/60.0;
+  block->output_bits = pl.output_bits;
+  memcpy(block->output_pwm, pl.output_pwm, sizeof(pl.output_pwm));
+  #ifdef USE_LINE_NUMBERS
+    block->line_number = line_number;
+  #endif
+  pl.output_bits = 0;
+  pl.previous_nominal_speed_sqr = 0.0; // Next block enters from a stop.
+
+  block_buffer_head = next_buffer_head;  
+  next_buffer_head = plan_next_block_index(block_buffer_head);
+  planner_recalculate();
+}
+
+
 // Reset the planner position vectors. Called by the system abort/initialization routine.
 void plan_sync_position()
 {
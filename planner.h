@@ -26,31 +26,47 @@
 // The number of linear motions that can be in the plan at any give time
 #ifndef BLOCK_BUFFER_SIZE
   #ifdef USE_LINE_NUMBERS
-    #define BLOCK_BUFFER_SIZE 16//16
+    #define BLOCK_BUFFER_SIZE 44
   #else
-    #define BLOCK_BUFFER_SIZE 18//18
+    #define BLOCK_BUFFER_SIZE 48
   #endif
 #endif
 
+// Maximum steps of an axis in one block, to fit the 16-bit step counts of plan_block_t. Longer lines
+// are queued as several blocks, see plan_next_block_target(). The rest of the 16 bits is left for the
+// backlash take-up steps of the block.
+#define MAX_BLOCK_STEPS 0xF000
+
+// Outputs that change with the motion, queued by plan_queue_output(). Index into output_pwm[].
+#define OUTPUT_PUMP  0 // Spindle PWM, M3/M4 S word
+#define OUTPUT_VALVE 1 // Spindle 2 PWM, M3/M4 E word
+#define N_OUTPUT     2
+#define OUTPUT_LASER_DYNAMIC 7 // Flag of OUTPUT_PUMP as a laser scaled with the speed. See LASER_DYNAMIC_POWER.
+
 // This struct stores a linear movement of a g-code block motion with its critical "nominal" values
 // are as specified in the source g-code. 
 typedef struct {
   // Fields used by the bresenham algorithm for tracing the line
   // NOTE: Used by stepper algorithm to execute the block correctly. Do not alter these values.
   uint8_t direction_bits;    // The direction bit set for this block (refers to *_DIRECTION_BIT in config.h)
-  uint32_t steps[N_AXIS];    // Step count along each axis
-  uint32_t step_event_count; // The maximum step axis count and number of steps required to complete this block. 
+  uint8_t backlash_bits;     // Axes (bit(idx)) whose steps[] include the backlash take-up of a reversal
+  uint16_t steps[N_AXIS];    // Step count along each axis. At most MAX_BLOCK_STEPS plus backlash.
+  uint16_t step_event_count; // The maximum step axis count and number of steps required to complete this block. 
 
   // Fields used by the motion planner to manage acceleration
   float entry_speed_sqr;         // The current planned entry speed at block junction in (mm/min)^2
   float max_entry_speed_sqr;     // Maximum allowable entry speed based on the minimum of junction limit and 
                                  //   neighboring nominal speeds with overrides in (mm/min)^2
-  float max_junction_speed_sqr;  // Junction entry speed limit based on direction vectors in (mm/min)^2
   float nominal_speed_sqr;       // Axis-limit adjusted nominal speed for this block in (mm/min)^2
   float acceleration;            // Axis-limit adjusted line acceleration in (mm/min^2)
-  float millimeters;             // The remaining distance for this block to be executed in (mm)
+  float millimeters;             // The remaining distance for this block to be executed in (mm), or
+                                 //   the remaining time of a dwell block (step_event_count 0) in (min)
   // uint8_t max_override;       // Maximum override value based on axis speed limits
 
+  // Output changes (bit(OUTPUT_*)) the stepper applies as it starts the block
+  uint8_t output_bits;
+  uint16_t output_pwm[N_OUTPUT];
+
   #ifdef USE_LINE_NUMBERS
     int32_t line_number;
   #endif
@@ -66,9 +82,32 @@ void plan_reset();
 #ifdef USE_LINE_NUMBERS
   void plan_buffer_line(float *target, float feed_rate, uint8_t invert_feed_rate, int32_t line_number);
 #else
-  void plan_buffer_line(float *target, float feed_rate, uint8_t invert_feed_rate, bool Compensation);
+  void plan_buffer_line(float *target, float feed_rate, uint8_t invert_feed_rate);
+#endif
+
+// Add a dwell of the given time to the buffer. Executed by the stepper in turn with the motion.
+#ifdef USE_LINE_NUMBERS
+  void plan_buffer_dwell(float seconds, int32_t line_number);
+#else
+  void plan_buffer_dwell(float seconds);
 #endif
 
+// Give the tool point travel of the next block, a Cartesian chord, or NULL for joint moves.
+void plan_set_tool_move(float *tool_delta);
+
+// Returns the number of steps taken up by the backlash of an axis when it reverses.
+uint16_t plan_backlash_steps(uint8_t idx);
+
+// Gives the end of the next block of a line to target and returns the number of blocks left for it.
+uint16_t plan_next_block_target(float *target, float *block_target);
+
+// Queues an output change to take effect when the motion queued so far is complete. OUTPUT_LASER_DYNAMIC
+// sets the OUTPUT_PUMP laser power of the following motion.
+void plan_queue_output(uint8_t output, uint16_t pwm);
+
+// Applies the queued output changes no block has taken along. Called once motion is complete.
+void plan_flush_outputs();
+
 // Called when the current block is no longer needed. Discards the block and makes the memory
 // availible for new blocks.
 void plan_discard_current_block();
@@ -94,6 +133,5 @@ uint8_t plan_get_block_buffer_count();
 // Returns the status of the block ring buffer. True, if buffer is full.
 uint8_t plan_check_full_buffer();
 
-int32_t get_pl(int axis);
 
 #endif
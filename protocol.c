@@ -123,6 +123,7 @@ void protocol_main_loop()
         line[char_counter] = 0; // Set string termination character.
         //printString_from_serial2(line);
         protocol_execute_line(line); // Line is complete. Execute it!
+        mc_cartesian_execute(); // Keep a streamed Cartesian line fed between lines.
         comment = COMMENT_NONE;
         char_counter = 0;
       } else {
@@ -172,6 +173,11 @@ void protocol_main_loop()
     }
 
 	reset_button_check();
+
+    // No next line is waiting, in the serial buffer or part read, to round a G64 corner with. Run the
+    // streamed Cartesian line to its end rather than have it stop at its hold point.
+    if ((char_counter == 0) && (comment == COMMENT_NONE)) { mc_cartesian_release(); }
+    mc_cartesian_execute(); // Queue more chords of a streamed Cartesian line, if there's room.
 	
     // If there are no more characters in the serial read buffer to be processed and executed,
     // this indicates that g-code streaming has either filled the planner buffer or has 
@@ -377,6 +383,7 @@ void protocol_execute_realtime()
       } else { // Motion is complete. Includes CYCLE, HOMING, and MOTION_CANCEL states.
         sys.suspend = SUSPEND_DISABLE;
         sys.state = STATE_IDLE;
+        if (plan_get_current_block() == NULL) { plan_flush_outputs(); } // Changes queued after the last block.
       }
       bit_false_atomic(sys_rt_exec_state,EXEC_CYCLE_STOP);
     }
@@ -410,6 +417,7 @@ void protocol_execute_realtime()
 // during a synchronize call, if it should happen. Also, waits for clean cycle end.
 void protocol_buffer_synchronize()
 {
+  mc_cartesian_flush(); // Everything issued so far has to be in the planner to be waited on.
   // If system is queued, ensure cycle resumes if the auto start flag is present.
   protocol_auto_cycle_start();
   do {
@@ -12,421 +12,722 @@
 #include "grbl.h"
 
 
-void transpose(double *a, double *b, int dim)             
+//---------------------------------------------------------------------------------------------------------
+
+#define pi          (3.1415926)  
+#define NOSOLUTION  (1000)
+
+
+
+#define N_SQRT      sqrt    
+
+#ifdef KINEMATICS_TABLE_TRIG
+// Table trig for the per-point kinematics. avr-libc's sin/cos/atan2 take on the order of 100us each
+// on the 16MHz AVR; a lookup with linear interpolation takes a fraction of that. With 256 steps per
+// octant/quadrant the error is below 5e-6 rad, a few micrometers at the tool.
+#define KIN_TRIG_N 256
+
+static const float sin_table[KIN_TRIG_N+1] PROGMEM = { // sin(i*pi/2/KIN_TRIG_N)
+  0.00000000, 0.00613588, 0.01227154, 0.01840673, 0.02454123, 0.03067480, 0.03680722, 0.04293826,
+  0.04906767, 0.05519524, 0.06132074, 0.06744392, 0.07356456, 0.07968244, 0.08579731, 0.09190896,
+  0.09801714, 0.10412163, 0.11022221, 0.11631863, 0.12241068, 0.12849811, 0.13458071, 0.14065824,
+  0.14673047, 0.15279719, 0.15885814, 0.16491312, 0.17096189, 0.17700422, 0.18303989, 0.18906866,
+  0.19509032, 0.20110463, 0.20711138, 0.21311032, 0.21910124, 0.22508391, 0.23105811, 0.23702361,
+  0.24298018, 0.24892761, 0.25486566, 0.26079412, 0.26671276, 0.27262136, 0.27851969, 0.28440754,
+  0.29028468, 0.29615089, 0.30200595, 0.30784964, 0.31368174, 0.31950203, 0.32531029, 0.33110631,
+  0.33688985, 0.34266072, 0.34841868, 0.35416353, 0.35989504, 0.36561300, 0.37131719, 0.37700741,
+  0.38268343, 0.38834505, 0.39399204, 0.39962420, 0.40524131, 0.41084317, 0.41642956, 0.42200027,
+  0.42755509, 0.43309382, 0.43861624, 0.44412214, 0.44961133, 0.45508359, 0.46053871, 0.46597650,
+  0.47139674, 0.47679923, 0.48218377, 0.48755016, 0.49289819, 0.49822767, 0.50353838, 0.50883014,
+  0.51410274, 0.51935599, 0.52458968, 0.52980362, 0.53499762, 0.54017147, 0.54532499, 0.55045797,
+  0.55557023, 0.56066158, 0.56573181, 0.57078075, 0.57580819, 0.58081396, 0.58579786, 0.59075970,
+  0.59569930, 0.60061648, 0.60551104, 0.61038281, 0.61523159, 0.62005721, 0.62485949, 0.62963824,
+  0.63439328, 0.63912444, 0.64383154, 0.64851440, 0.65317284, 0.65780669, 0.66241578, 0.66699992,
+  0.67155895, 0.67609270, 0.68060100, 0.68508367, 0.68954054, 0.69397146, 0.69837625, 0.70275474,
+  0.70710678, 0.71143220, 0.71573083, 0.72000251, 0.72424708, 0.72846439, 0.73265427, 0.73681657,
+  0.74095113, 0.74505779, 0.74913639, 0.75318680, 0.75720885, 0.76120239, 0.76516727, 0.76910334,
+  0.77301045, 0.77688847, 0.78073723, 0.78455660, 0.78834643, 0.79210658, 0.79583690, 0.79953727,
+  0.80320753, 0.80684755, 0.81045720, 0.81403633, 0.81758481, 0.82110251, 0.82458930, 0.82804505,
+  0.83146961, 0.83486287, 0.83822471, 0.84155498, 0.84485357, 0.84812034, 0.85135519, 0.85455799,
+  0.85772861, 0.86086694, 0.86397286, 0.86704625, 0.87008699, 0.87309498, 0.87607009, 0.87901223,
+  0.88192126, 0.88479710, 0.88763962, 0.89044872, 0.89322430, 0.89596625, 0.89867447, 0.90134885,
+  0.90398929, 0.90659570, 0.90916798, 0.91170603, 0.91420976, 0.91667906, 0.91911385, 0.92151404,
+  0.92387953, 0.92621024, 0.92850608, 0.93076696, 0.93299280, 0.93518351, 0.93733901, 0.93945922,
+  0.94154407, 0.94359346, 0.94560733, 0.94758559, 0.94952818, 0.95143502, 0.95330604, 0.95514117,
+  0.95694034, 0.95870347, 0.96043052, 0.96212140, 0.96377607, 0.96539444, 0.96697647, 0.96852209,
+  0.97003125, 0.97150389, 0.97293995, 0.97433938, 0.97570213, 0.97702814, 0.97831737, 0.97956977,
+  0.98078528, 0.98196387, 0.98310549, 0.98421009, 0.98527764, 0.98630810, 0.98730142, 0.98825757,
+  0.98917651, 0.99005821, 0.99090264, 0.99170975, 0.99247953, 0.99321195, 0.99390697, 0.99456457,
+  0.99518473, 0.99576741, 0.99631261, 0.99682030, 0.99729046, 0.99772307, 0.99811811, 0.99847558,
+  0.99879546, 0.99907773, 0.99932238, 0.99952942, 0.99969882, 0.99983058, 0.99992470, 0.99998118,
+  1.00000000
+};
+
+static const float atan_table[KIN_TRIG_N+1] PROGMEM = { // atan(i/KIN_TRIG_N)
+  0.00000000, 0.00390623, 0.00781234, 0.01171821, 0.01562373, 0.01952877, 0.02343321, 0.02733694,
+  0.03123983, 0.03514178, 0.03904265, 0.04294233, 0.04684071, 0.05073767, 0.05463308, 0.05852683,
+  0.06241881, 0.06630889, 0.07019697, 0.07408292, 0.07796663, 0.08184799, 0.08572688, 0.08960318,
+  0.09347678, 0.09734757, 0.10121544, 0.10508027, 0.10894196, 0.11280038, 0.11665544, 0.12050701,
+  0.12435499, 0.12819928, 0.13203976, 0.13587633, 0.13970887, 0.14353729, 0.14736148, 0.15118133,
+  0.15499674, 0.15880761, 0.16261383, 0.16641530, 0.17021193, 0.17400360, 0.17779023, 0.18157171,
+  0.18534795, 0.18911885, 0.19288431, 0.19664425, 0.20039855, 0.20414715, 0.20788993, 0.21162681,
+  0.21535770, 0.21908251, 0.22280115, 0.22651354, 0.23021959, 0.23391921, 0.23761231, 0.24129883,
+  0.24497866, 0.24865174, 0.25231798, 0.25597730, 0.25962963, 0.26327488, 0.26691299, 0.27054387,
+  0.27416745, 0.27778366, 0.28139243, 0.28499369, 0.28858736, 0.29217338, 0.29575169, 0.29932220,
+  0.30288487, 0.30643962, 0.30998639, 0.31352512, 0.31705575, 0.32057822, 0.32409247, 0.32759844,
+  0.33109608, 0.33458532, 0.33806612, 0.34153843, 0.34500218, 0.34845733, 0.35190383, 0.35534162,
+  0.35877067, 0.36219092, 0.36560233, 0.36900485, 0.37239845, 0.37578307, 0.37915867, 0.38252522,
+  0.38588267, 0.38923099, 0.39257014, 0.39590007, 0.39922077, 0.40253219, 0.40583429, 0.40912706,
+  0.41241044, 0.41568442, 0.41894897, 0.42220405, 0.42544964, 0.42868571, 0.43191224, 0.43512919,
+  0.43833656, 0.44153431, 0.44472242, 0.44790088, 0.45106966, 0.45422874, 0.45737810, 0.46051773,
+  0.46364761, 0.46676772, 0.46987806, 0.47297860, 0.47606933, 0.47915024, 0.48222132, 0.48528256,
+  0.48833395, 0.49137548, 0.49440714, 0.49742892, 0.50044081, 0.50344282, 0.50643493, 0.50941715,
+  0.51238946, 0.51535187, 0.51830436, 0.52124695, 0.52417963, 0.52710240, 0.53001525, 0.53291820,
+  0.53581124, 0.53869437, 0.54156761, 0.54443094, 0.54728438, 0.55012793, 0.55296160, 0.55578539,
+  0.55859932, 0.56140337, 0.56419758, 0.56698193, 0.56975645, 0.57252114, 0.57527602, 0.57802108,
+  0.58075635, 0.58348184, 0.58619755, 0.58890350, 0.59159971, 0.59428618, 0.59696294, 0.59962999,
+  0.60228735, 0.60493503, 0.60757306, 0.61020144, 0.61282020, 0.61542935, 0.61802891, 0.62061890,
+  0.62319933, 0.62577022, 0.62833160, 0.63088348, 0.63342588, 0.63595883, 0.63848233, 0.64099642,
+  0.64350111, 0.64599642, 0.64848239, 0.65095902, 0.65342634, 0.65588438, 0.65833315, 0.66077268,
+  0.66320299, 0.66562411, 0.66803606, 0.67043887, 0.67283255, 0.67521713, 0.67759265, 0.67995911,
+  0.68231655, 0.68466500, 0.68700448, 0.68933501, 0.69165662, 0.69396934, 0.69627319, 0.69856821,
+  0.70085441, 0.70313182, 0.70540048, 0.70766040, 0.70991162, 0.71215416, 0.71438805, 0.71661332,
+  0.71883000, 0.72103811, 0.72323768, 0.72542875, 0.72761133, 0.72978546, 0.73195117, 0.73410848,
+  0.73625743, 0.73839804, 0.74053034, 0.74265436, 0.74477013, 0.74687767, 0.74897703, 0.75106822,
+  0.75315128, 0.75522624, 0.75729312, 0.75935195, 0.76140277, 0.76344560, 0.76548048, 0.76750743,
+  0.76952648, 0.77153766, 0.77354101, 0.77553655, 0.77752431, 0.77950432, 0.78147661, 0.78344122,
+  0.78539816
+};
+
+// Linearly interpolates 'table' at the fractional index x, 0 <= x <= KIN_TRIG_N.
+static float kin_table(const float *table, float x)
 {
-  int i;
-  int j;
+  uint16_t i = x;
+  if (i >= KIN_TRIG_N) { i = KIN_TRIG_N-1; }
+  float a = pgm_read_float(&table[i]);
+  return(a + (pgm_read_float(&table[i+1]) - a)*(x - i));
+}
 
-  for (i = 0; i < dim; i++) {
-    for (j = 0; j < dim; j++) {
-      a[i*dim + j] = b[j*dim + i];
-    }
+static float kin_sin(float x)
+{
+  float q = x*(2/pi);
+  float quadrant = floor(q);
+  float r = (q - quadrant)*KIN_TRIG_N;
+  switch ((int32_t)quadrant & 3) {
+    case 0: return(kin_table(sin_table, r));
+    case 1: return(kin_table(sin_table, KIN_TRIG_N - r));
+    case 2: return(-kin_table(sin_table, r));
+    default: return(-kin_table(sin_table, KIN_TRIG_N - r));
   }
 }
 
-void MatrixMult(double *out, double *m1, double *m2, int dim)  
+static float kin_cos(float x) { return(kin_sin(x + pi/2)); }
+
+static float kin_atan2(float y, float x)
 {
-  int i;
-  int j;
-  int k;
-  double sum;
-  for (i = 0; i < dim; i++) {
-    for (j = 0; j < dim; j++) {
-      sum = 0;
-      for (k = 0; k < dim; k++) {
-        sum += m1[i*dim + k] * m2[k*dim + j];
-      }
-      out[i*dim+j] = sum;
-    }
+  float ax = fabs(x), ay = fabs(y), a;
+  if (ay <= ax) { 
+    if (ax == 0) { return(0); }
+    a = kin_table(atan_table, ay/ax*KIN_TRIG_N);
+  } else { 
+    a = pi/2 - kin_table(atan_table, ax/ay*KIN_TRIG_N);
   }
+  if (x < 0) { a = pi - a; }
+  return((y < 0) ? -a : a);
 }
-//---------------------------------------------------------------------------------------------------------
 
-#define pi          (3.1415926)  
-#define NOSOLUTION  (1000)
-#define OUTANGLIMIT (1001)
+#define KIN_SIN   kin_sin
+#define KIN_COS   kin_cos
+#define KIN_ATAN2 kin_atan2
+#else
+#define KIN_SIN   sin
+#define KIN_COS   cos
+#define KIN_ATAN2 atan2
+#endif
 
+kinematics_t kin;
 
 
-#define N_SQRT      sqrt    
+void InverseInit(void) 
+{
+    kin.D1xD1          = settings.robot_qinnew.D1 * settings.robot_qinnew.D1;
+    kin.A1xA1          = settings.robot_qinnew.A1 * settings.robot_qinnew.A1;
+    kin.A2xA2          = settings.robot_qinnew.A2 * settings.robot_qinnew.A2;
+    kin.A3xA3          = settings.robot_qinnew.A3 * settings.robot_qinnew.A3;
+    kin.D4xD4          = settings.robot_qinnew.D4 * settings.robot_qinnew.D4;
+    kin.D4_A3          = sqrt(kin.D4xD4 + kin.A3xA3);
+    kin.ATAN2D4_A3     = atan2(settings.robot_qinnew.D4,settings.robot_qinnew.A3);
+    kin.czeta_offset   = kin.A2xA2 + kin.D4xD4 + kin.A3xA3;
+    kin.inv_2xA2xD4_A3 = 1.0 / (2 * settings.robot_qinnew.A2 * kin.D4_A3);
+    kin.L_abs          = fabs(settings.robot_qinnew.L);
+    kin.reach_min_sq   = (settings.robot_qinnew.A2 - kin.D4_A3) * (settings.robot_qinnew.A2 - kin.D4_A3);
+    kin.reach_max_sq   = (settings.robot_qinnew.A2 + kin.D4_A3) * (settings.robot_qinnew.A2 + kin.D4_A3);
+    kin.fk_valid       = false;
+}
 
-double s;
-double r;
-double D4_A3;         
-double ATAN2D4_A3;     
-double atan2_s_r;      
-double atan2_s_r1;    
-unsigned int _D1xD1_;           
-unsigned int _A1xA1_;          
-unsigned int _A2xA2_;         
-unsigned int _A3xA3_;          
-unsigned int _D4xD4_;          
 
+// Solves the spherical wrist joints q4..q6 (radians) that give the tool orientation R60 once the
+// arm joints are at q1 and q2+q3. Writes both wrist solutions: q[0..2] and the flipped q[3..5].
+static void ik_wrist(double R60[3][3], double q1, double q23, double *q)
+{
+    double c1 = KIN_COS(q1), s1 = KIN_SIN(q1);
+    double c23 = KIN_COS(q23), s23 = KIN_SIN(q23);
+
+    // R63 = RT63_cita456 * R30^T * R60 with R30 = [[c1c23,-c1s23,-s1],[s1c23,-s1s23,c1],[-s23,-c23,0]].
+    // RT63_cita456 = [[1,0,0],[0,0,1],[0,-1,0]] only reorders the rows of R30^T*R60, so only the seven
+    // entries used below are formed, each a dot product of an R30 column with an R60 column.
+    double a0 = c1*c23, a1 = s1*c23;      // R30 column 0 is (a0, a1, -s23)
+    double b0 = -c1*s23, b1 = -s1*s23;    // R30 column 1 is (b0, b1, -c23)
+    double g11 =  a0*R60[0][0] + a1*R60[1][0] - s23*R60[2][0];
+    double g12 =  a0*R60[0][1] + a1*R60[1][1] - s23*R60[2][1];
+    double g13 =  a0*R60[0][2] + a1*R60[1][2] - s23*R60[2][2];
+    double g23 = -s1*R60[0][2] + c1*R60[1][2];
+    double g31 = -(b0*R60[0][0] + b1*R60[1][0] - c23*R60[2][0]);
+    double g32 = -(b0*R60[0][1] + b1*R60[1][1] - c23*R60[2][1]);
+    double g33 = -(b0*R60[0][2] + b1*R60[1][2] - c23*R60[2][2]);
+    
+    double theta5 = KIN_ATAN2(N_SQRT(g31*g31 + g32*g32), g33);
+    if (theta5 < 0.0001) {
+        // Wrist singular: q4 and q6 turn about the same axis. Put all of it on q6.
+        q[0] = 0; q[1] = 0; q[2] = KIN_ATAN2(-g12, g11);
+    } else if (fabs(theta5 - pi) < 0.0001) {
+        q[0] = 0; q[1] = theta5; q[2] = KIN_ATAN2(g12, -g11);
+    } else {
+        double temp = KIN_SIN(theta5);
+        q[0] = -KIN_ATAN2(g23/temp, g13/temp);
+        q[1] = theta5;
+        q[2] = KIN_ATAN2(g32/temp, -g31/temp);
+    }
+    q[3] = q[0] + pi;
+    q[4] = -q[1];
+    q[5] = q[2] + pi;
+}
 
 
-void InverseInit(void) 
+// Returns the angle 'd' in degrees wrapped to -180..180. avr-libc has no remainder().
+static double ik_wrap_angle(double d)
 {
-    _D1xD1_     = settings.robot_qinnew.D1 * settings.robot_qinnew.D1;
-    _A1xA1_     = settings.robot_qinnew.A1 * settings.robot_qinnew.A1;
-    _A2xA2_     = settings.robot_qinnew.A2 * settings.robot_qinnew.A2;
-    _A3xA3_     = settings.robot_qinnew.A3 * settings.robot_qinnew.A3;
-    _D4xD4_     = settings.robot_qinnew.D4 * settings.robot_qinnew.D4;
-    D4_A3       = sqrt(_D4xD4_ + _A3xA3_);
-    ATAN2D4_A3  = atan2(settings.robot_qinnew.D4,settings.robot_qinnew.A3);
+    return(d - 360*floor(d/360 + 0.5));
 }
 
 
-double THE2(double xtip,double ytip,double ztip,double theta1,double zeta, double lenda)
-{  
-    return (lenda - atan2_s_r) ;     
+// Returns the equivalent of 'angle' (any turn) closest to 'ref' that lies within the soft limits
+// of the axis, when they are enabled. Returns NOSOLUTION if no turn of it does.
+static double ik_fit_joint(uint8_t idx, double angle, double ref)
+{
+    angle -= 360*floor((angle - ref)/360 + 0.5); // Nearest turn to ref.
+    if (bit_isfalse(settings.flags,BITFLAG_SOFT_LIMIT_ENABLE)) { return(angle); }
+    // Same bounds as limits_soft_check(), which mc_line() would otherwise trip on mid-line.
+    double best = NOSOLUTION;
+    int8_t turn;
+    for (turn = -1; turn <= 1; turn++) {
+        double a = angle + 360*turn;
+        if ((a >= -settings.min_travel[idx]) && (a <= settings.max_travel[idx]) &&
+            ((best == NOSOLUTION) || (fabs(a - ref) < fabs(best - ref)))) { best = a; }
+    }
+    return(best);
 }
 
-double THE2COMP(double xtip,double ytip,double ztip,double theta1,double zeta , double lenda)
-{  
-    return (lenda - atan2_s_r1);               
-}
 
-double conversion(double theta,double upperlimit,double lowerlimit)
+// Solves the joint angles for a tool point 'position' (X,Y,Z in mm) and tool orientation R60.
+// Re-entrant: reads only its arguments, settings and the kinematics cache, and keeps all scratch on
+// the stack.
+// Up to eight solutions exist: shoulder front/back, elbow up/down and wrist flipped or not. Each is
+// moved to the turn of every joint nearest the current one and checked against the soft limits.
+// With 'config' == IK_CONFIG_NEAREST the valid solution with the smallest largest joint excursion
+// from 'joint' is taken, so interpolated moves stay on one branch. Otherwise only the IK_CONFIG_*
+// combination given is accepted.
+// On entry 'joint' holds the current joint angles (machine axis order, degrees). Returns STATUS_OK
+// and the solution in 'joint' (D_AXIS left untouched), or an error status with 'joint' unchanged.
+static uint8_t ik_solve_frame(const float *position, double R60[3][3], uint8_t config, joint_t *joint)
 {
-        return (theta * 180 / pi);
+    double xtip = position[X_Cartesian] + R60[0][2] * kin.L_abs;
+    double ytip = position[Y_Cartesian] + R60[1][2] * kin.L_abs;
+    double ztip = position[Z_Cartesian] + R60[2][2] * kin.L_abs;
+    
+    // Wrist center in the arm plane: u along the upper arm's heading past joint 2, v downward from it.
+    double rho = hypot(xtip, ytip);
+    double v   = settings.robot_qinnew.D1 - ztip;
+
+    // Branch and bound: a partial solution already moving a joint further than the best complete one
+    // cannot win, so the wrist, which costs most, is only solved for arm solutions that still can.
+    // Trying the shoulder and elbow nearest the current joints first makes that the common case.
+    uint8_t reachable = false;
+    float best[N_AXIS];
+    double best_cost = NOSOLUTION;
+    double theta1 = KIN_ATAN2(ytip, xtip);
+    uint8_t back_first = (fabs(ik_wrap_angle(theta1*180/pi - joint->angle[E_AXIS])) > 90);
+    uint8_t pass, shoulder, elbow, wrist, idx;
+    for (pass = 0; pass < 2; pass++) {
+        shoulder = (pass ^ back_first) ? IK_CONFIG_SHOULDER_BACK : 0;
+        if ((config != IK_CONFIG_NEAREST) && ((config & IK_CONFIG_SHOULDER_BACK) != shoulder)) { continue; }
+        double q1 = theta1 + (shoulder ? pi : 0);
+        double u  = (shoulder ? -rho : rho) - settings.robot_qinnew.A1;
+
+        double czeta = (u*u + v*v - kin.czeta_offset) * kin.inv_2xA2xD4_A3;
+        if (fabs(czeta) > 1) { continue; } // No valid value for theta3.
+        double zeta = KIN_ATAN2(N_SQRT(1 - czeta*czeta), czeta);
+        double atan2_v_u = KIN_ATAN2(-v, u);
+
+        float angle[N_AXIS];
+        angle[E_AXIS] = ik_fit_joint(E_AXIS, q1*180/pi, joint->angle[E_AXIS]);
+        angle[D_AXIS] = joint->angle[D_AXIS];
+
+        // Both elbows' q2/q3 are cheap, so solve them up front and try the nearer one first.
+        double q2[2], q3[2], arm_cost[2];
+        for (elbow = 0; elbow < 2; elbow++) {
+            double z  = elbow ? zeta : -zeta;
+            q3[elbow] = -(z + kin.ATAN2D4_A3);
+            q2[elbow] = KIN_ATAN2(kin.D4_A3 * KIN_SIN(z), settings.robot_qinnew.A2 + kin.D4_A3 * KIN_COS(z)) - atan2_v_u;
+            arm_cost[elbow] = max(fabs(ik_wrap_angle(q2[elbow]*180/pi + 90 - joint->angle[F_AXIS])),
+                                  fabs(ik_wrap_angle(q3[elbow]*180/pi - joint->angle[G_AXIS])));
+        }
+        uint8_t down_first = (arm_cost[1] < arm_cost[0]);
+        for (elbow = 0; elbow < 2; elbow++) {
+            uint8_t e = elbow ^ down_first;
+            if ((config != IK_CONFIG_NEAREST) && (((config & IK_CONFIG_ELBOW_DOWN) != 0) != e)) { continue; }
+            reachable = true;
+            if (angle[E_AXIS] == NOSOLUTION) { continue; }
+            angle[F_AXIS] = ik_fit_joint(F_AXIS, q2[e]*180/pi + 90, joint->angle[F_AXIS]);
+            angle[G_AXIS] = ik_fit_joint(G_AXIS, q3[e]*180/pi, joint->angle[G_AXIS]);
+            if ((angle[F_AXIS] == NOSOLUTION) || (angle[G_AXIS] == NOSOLUTION)) { continue; }
+            double cost_arm = max(fabs(angle[E_AXIS] - joint->angle[E_AXIS]),
+                                  max(fabs(angle[F_AXIS] - joint->angle[F_AXIS]), fabs(angle[G_AXIS] - joint->angle[G_AXIS])));
+            if (cost_arm >= best_cost) { continue; }
+
+            double q[6];
+            ik_wrist(R60, q1, q2[e]+q3[e], q);
+            for (wrist = 0; wrist <= IK_CONFIG_WRIST_FLIP; wrist += IK_CONFIG_WRIST_FLIP) {
+                if ((config != IK_CONFIG_NEAREST) && ((config & IK_CONFIG_WRIST_FLIP) != wrist)) { continue; }
+                double *qw = wrist ? &q[3] : &q[0];
+                angle[A_AXIS] = ik_fit_joint(A_AXIS, qw[0]*180/pi, joint->angle[A_AXIS]);
+                angle[B_AXIS] = ik_fit_joint(B_AXIS, qw[1]*180/pi - 90, joint->angle[B_AXIS]);
+                angle[C_AXIS] = ik_fit_joint(C_AXIS, qw[2]*180/pi, joint->angle[C_AXIS]);
+
+                // The slowest joint sets the move time, so rank by the largest excursion.
+                double cost = cost_arm;
+                for (idx = A_AXIS; idx <= C_AXIS; idx++) {
+                    if (angle[idx] == NOSOLUTION) { break; }
+                    cost = max(cost, fabs(angle[idx] - joint->angle[idx]));
+                }
+                if ((idx > C_AXIS) && (cost < best_cost)) {
+                    best_cost = cost;
+                    memcpy(best, angle, sizeof(best));
+                }
+            }
+        }
+    }
+
+    if (!reachable) { return(STATUS_GCODE_OUT_OF_WORKSPACE); }
+    if (best_cost == NOSOLUTION) { return(STATUS_GCODE_JOINT_LIMIT); }
+#ifdef debug
+  printString("\r\nIK:");
+  for (idx = 0; idx < N_AXIS; idx++) { printString(" "); printFloat(best[idx],2); }
+  printString("\r\n");
+#endif
+    memcpy(joint->angle, best, sizeof(best));
+    return(STATUS_OK);
 }
 
-void Inverse(double x_wrist,double y_wrist,double z_wrist,double alpha,double beta,double gama)
+
+// Solves the joint angles for a Cartesian tool pose, see ik_solve_frame().
+uint8_t ik_solve(const pose_t *pose, uint8_t config, joint_t *joint)
 {
- 	alpha = alpha * pi/180;     
- 	beta  = beta  * pi/180;
-  	gama  = gama  * pi/180;
+    double alpha = pose->coord[RX_Cartesian] * pi/180;     
+    double beta  = pose->coord[RY_Cartesian] * pi/180;
+    double gama  = pose->coord[RZ_Cartesian] * pi/180;
     
-    double  temp1 = cos(alpha);
-    double  temp2 = cos(beta);
-    double  temp3 = cos(gama);
-    double  temp4 = sin(alpha);
-    double  temp5 = sin(beta);
-    double  temp6 = sin(gama);
+    double  temp1 = KIN_COS(alpha);
+    double  temp2 = KIN_COS(beta);
+    double  temp3 = KIN_COS(gama);
+    double  temp4 = KIN_SIN(alpha);
+    double  temp5 = KIN_SIN(beta);
+    double  temp6 = KIN_SIN(gama);
     
     double R60[3][3] = { { temp2*temp3 , temp3*temp4*temp5 - temp1*temp6 , temp1*temp3*temp5 + temp4*temp6},
                          { temp2*temp6 , temp4*temp5*temp6 + temp1*temp3 , temp1*temp5*temp6 - temp3*temp4},
                          {-temp5       , temp2*temp4                     , temp1*temp2                    }
                        };
+    return(ik_solve_frame(pose->coord, R60, config, joint));
+}
 
-    double xtip = x_wrist + R60[0][2] * abs(settings.robot_qinnew.L);
-    double ytip = y_wrist + R60[1][2] * abs(settings.robot_qinnew.L);
-    double ztip = z_wrist + R60[2][2] * abs(settings.robot_qinnew.L);
-    
-    double theta1  = atan2(ytip,xtip);
-    double theta11 = pi + theta1;
-    double THETA1  = theta1 * 180/pi;
-    double THETA11 = theta11 * 180/pi;
+// Checks that a tool pose lies in the arm's envelope, without solving it. The wrist center has to be
+// within the distance range from joint 2 the elbow can span, for the shoulder turned either way.
+// This is the same test ik_solve() starts with, so it passes exactly the poses that have an arm
+// solution. Joint limits are not checked. Costs four trig calls against ik_solve()'s dozens, and
+// follows the geometry settings, which a precomputed voxel map could not.
+uint8_t ik_reachable(const pose_t *pose)
+{
+    double alpha = pose->coord[RX_Cartesian] * pi/180;     
+    double beta  = pose->coord[RY_Cartesian] * pi/180;
+    double gama  = pose->coord[RZ_Cartesian] * pi/180;
+    double ca = KIN_COS(alpha), sa = KIN_SIN(alpha);
+    double cb = KIN_COS(beta);
+    double cg = KIN_COS(gama), sg = KIN_SIN(gama);
+    double sb = KIN_SIN(beta);
+
+    // Tool z axis, the third column of R60.
+    double xtip = pose->coord[X_Cartesian] + (ca*cg*sb + sa*sg) * kin.L_abs;
+    double ytip = pose->coord[Y_Cartesian] + (ca*sb*sg - cg*sa) * kin.L_abs;
+    double ztip = pose->coord[Z_Cartesian] + (ca*cb) * kin.L_abs;
+
+    double rho = hypot(xtip, ytip);
+    double v   = settings.robot_qinnew.D1 - ztip;
+    double u   = rho - settings.robot_qinnew.A1;
+    double d   = u*u + v*v;
+    if ((d >= kin.reach_min_sq) && (d <= kin.reach_max_sq)) { return(STATUS_OK); }
+    u = -rho - settings.robot_qinnew.A1;
+    d = u*u + v*v;
+    if ((d >= kin.reach_min_sq) && (d <= kin.reach_max_sq)) { return(STATUS_OK); }
+    return(STATUS_GCODE_OUT_OF_WORKSPACE);
+}
 
-    s = ztip - settings.robot_qinnew.D1;
-    r = N_SQRT(pow(xtip - settings.robot_qinnew.A1*cos(theta1) ,2) + pow((ytip - settings.robot_qinnew.A1*sin(theta1)) ,2));
 
-    atan2_s_r  = atan2(s, r);       
-    if(s < 0) {
-        atan2_s_r1 = -pi - atan2_s_r;
-    } else {
-        atan2_s_r1 = pi - atan2_s_r;
-    }
+// Solves the tool pose for joint angles given in machine axis order (degrees). Closed form of
+// T10*T21*...*T65: the DH frames are mostly constant 0/1 entries, so only the products that
+// survive are evaluated, and of R60 only the five entries the RX/RY/RZ extraction needs.
+void fk_solve(const float *angle, pose_t *out)
+{
+  double q1 = angle[E_AXIS] * pi/180;
+  double q2 = (angle[F_AXIS] - 90) * pi/180;
+  double q3 = angle[G_AXIS] * pi/180;
+  double q4 = angle[A_AXIS] * pi/180;
+  double q5 = (angle[B_AXIS] + 90) * pi/180;
+  double q6 = angle[C_AXIS] * pi/180;
+
+  double s1 = KIN_SIN(q1), c1 = KIN_COS(q1);
+  double s2 = KIN_SIN(q2), c2 = KIN_COS(q2);
+  double s23 = KIN_SIN(q2+q3), c23 = KIN_COS(q2+q3);
+  double s4 = KIN_SIN(q4), c4 = KIN_COS(q4);
+  double s5 = KIN_SIN(q5), c5 = KIN_COS(q5);
+  double s6 = KIN_SIN(q6), c6 = KIN_COS(q6);
+
+  // R30 and the wrist center. Joints 2 and 3 are parallel, so they only appear as q2 and q2+q3.
+  double R30[3][3] = { { c1*c23 , -c1*s23 , -s1},
+                       { s1*c23 , -s1*s23 ,  c1},
+                       {-s23    , -c23    ,  0 } };
+  double reach = settings.robot_qinnew.A1 + settings.robot_qinnew.A2*c2 
+                 + settings.robot_qinnew.A3*c23 - settings.robot_qinnew.D4*s23;
+  double px = c1*reach;
+  double py = s1*reach;
+  double pz = settings.robot_qinnew.D1 - settings.robot_qinnew.A2*s2 
+              - settings.robot_qinnew.A3*s23 - settings.robot_qinnew.D4*c23;
+
+  // R40 = R30*R43, where R43 only mixes columns 0 and 2 of R30 by q4 and moves column 1 to 2.
+  double R40[3][3];
+  uint8_t i;
+  for (i=0; i<3; i++) {
+    R40[i][0] =  R30[i][0]*c4 - R30[i][2]*s4;
+    R40[i][1] = -R30[i][0]*s4 - R30[i][2]*c4;
+    R40[i][2] =  R30[i][1];
+  }
 
-    double czeta = (r*r + s*s  - _A2xA2_ - _D4xD4_ - _A3xA3_) / (2 * settings.robot_qinnew.A2 * D4_A3);     
-    
-    double theta3 , theta33;
-    double zeta   , zeta1;
-    double THETA3 , THETA33;
-    
-    if(fabs(czeta) <= 1) {
-        double szeta = N_SQRT(1 - czeta*czeta);
-        zeta  = atan2(szeta,czeta);
-        zeta1 = -zeta; 
-
-        theta3  = -(zeta  + ATAN2D4_A3);
-        theta33 = -(zeta1 + ATAN2D4_A3);
-        
-        THETA3  = conversion(theta3  , 70 ,-180);
-        THETA33 = conversion(theta33 , 70 ,-180);
-    } else {
-        theta3 = NOSOLUTION;
-        theta33= NOSOLUTION;
-		printString("\r\nGOAL OUT OF WORKSPACE, THERE IS NO VAILD VALUS FOR  THETA3!");
-		return;
+  // Tool point: R64*p65 = [L*s5, 0, -L*c5] in frame 4.
+  double L = settings.robot_qinnew.L;
+  out->coord[X_Cartesian] = px + L*(s5*R40[0][0] - c5*R40[0][2]);
+  out->coord[Y_Cartesian] = py + L*(s5*R40[1][0] - c5*R40[1][2]);
+  out->coord[Z_Cartesian] = pz + L*(s5*R40[2][0] - c5*R40[2][2]);
+
+  // R60 = R40*R64 with R64 = [[c5c6,-c5s6,s5],[-s6,-c6,0],[s5c6,-s5s6,-c5]].
+  double r00 = R40[0][0]*c5*c6 - R40[0][1]*s6 + R40[0][2]*s5*c6;
+  double r10 = R40[1][0]*c5*c6 - R40[1][1]*s6 + R40[1][2]*s5*c6;
+  double r20 = R40[2][0]*c5*c6 - R40[2][1]*s6 + R40[2][2]*s5*c6;
+  double r21 = -R40[2][0]*c5*s6 - R40[2][1]*c6 - R40[2][2]*s5*s6;
+  double r22 = R40[2][0]*s5 - R40[2][2]*c5;
+
+  out->coord[RX_Cartesian] = KIN_ATAN2(r21, r22)*180/pi;
+  out->coord[RY_Cartesian] = KIN_ATAN2(-r20, sqrt(r21*r21 + r22*r22))*180/pi;
+  out->coord[RZ_Cartesian] = KIN_ATAN2(r10, r00)*180/pi;
+}
 
-    }
 
-    temp1 = N_SQRT(pow((xtip - settings.robot_qinnew.A1*cos(theta11)),2) + pow((ytip - settings.robot_qinnew.A1*sin(theta11)),2));    // 这里原来是r 
-    double czetai = (temp1 + pow(s,2)  - pow(settings.robot_qinnew.A2,2) - pow(settings.robot_qinnew.D4,2) - pow(settings.robot_qinnew.A3,2)) / (2 * settings.robot_qinnew.A2 * D4_A3);
-    double theta3i;
-    double theta33i;
-    double zetai;
-    double zeta1i;
-    double THETA3i;
-    double THETA33i;
-    if(fabs(czetai) <= 1) {
-        double szetai = N_SQRT(1-pow(czetai,2));   
-        zetai  = atan2( szetai , czetai);
-        zeta1i   = -zetai;
-        theta3i  = -(zetai  + ATAN2D4_A3);
-        theta33i = -(zeta1i + ATAN2D4_A3);
-        
-        THETA3i  = conversion(theta3i  , 70 ,-180);
-        THETA33i = conversion(theta33i , 70 ,-180);
-    } else {
-        theta3i =NOSOLUTION;
-        theta33i=NOSOLUTION;
-    }
+// Returns the tool pose for a step position snapshot. Status reports poll this at 5-20Hz, mostly
+// while idle or between short moves, so the last solution is reused until the steps change.
+void fk_solve_steps(int32_t *steps, pose_t *out)
+{
+  static int32_t fk_steps[N_AXIS];
+  static pose_t fk_pose;
+  if (!kin.fk_valid || memcmp(fk_steps, steps, sizeof(fk_steps))) {
+    float angle[N_AXIS];
+    memcpy(fk_steps, steps, sizeof(fk_steps));
+    system_convert_array_steps_to_mpos(angle, fk_steps);
+    fk_solve(angle, &fk_pose);
+    kin.fk_valid = true;
+  }
+  memcpy(out, &fk_pose, sizeof(pose_t));
+}
 
-    double THETA2;
-    double THETA22;
-    if(theta3 == NOSOLUTION) {
-    } else {
-        temp1 = atan2(D4_A3 * sin(zeta) , settings.robot_qinnew.A2 + D4_A3 * cos(zeta));
-        double theta2  = THE2(xtip,ytip,ztip,theta1,zeta,temp1);        
-        double theta22 = THE2COMP(xtip,ytip,ztip,theta1,zeta,temp1);
-        
-        THETA2  = conversion(theta2 , 0, -130);                  
-        THETA22 = conversion(theta22, 0, -130);
-        
-    }
-    
-    double theta2i;
-    double theta22i;
-    double THETA2i;
-    double THETA22i;
-    if(theta33 == NOSOLUTION) {
-    } else {
-        temp1 = atan2(D4_A3 * sin(zeta1) , settings.robot_qinnew.A2 + D4_A3 * cos(zeta1));
-        theta2i  = THE2(xtip,ytip,ztip,theta1,zeta1,temp1);
-        theta22i = THE2COMP(xtip,ytip,ztip,theta1,zeta1,temp1);
 
-        THETA2i  = conversion(theta2i , 0, -130);
-        THETA22i = conversion(theta22i, 0, -130);
-        
-    }
 
-    double THETA2j;
-    double THETA22j;
-    if(theta3i == NOSOLUTION) {
-    } else {
-        temp1 = atan2(D4_A3 * sin(zetai) , settings.robot_qinnew.A2 + D4_A3 * cos(zetai));
-        double theta2j  = THE2(xtip,ytip,ztip,theta11,zetai,temp1);
-        double theta22j = THE2COMP(xtip,ytip,ztip,theta11,zetai,temp1);
+// Returns the unit quaternion (w,x,y,z) of the fixed-axis RX/RY/RZ rotation Rz*Ry*Rx of a pose.
+static void pose_quaternion(const pose_t *pose, float *q)
+{
+  float ca = cos(pose->coord[RX_Cartesian]*pi/360), sa = sin(pose->coord[RX_Cartesian]*pi/360);
+  float cb = cos(pose->coord[RY_Cartesian]*pi/360), sb = sin(pose->coord[RY_Cartesian]*pi/360);
+  float cg = cos(pose->coord[RZ_Cartesian]*pi/360), sg = sin(pose->coord[RZ_Cartesian]*pi/360);
+  q[0] = ca*cb*cg + sa*sb*sg;
+  q[1] = sa*cb*cg - ca*sb*sg;
+  q[2] = ca*sb*cg + sa*cb*sg;
+  q[3] = ca*cb*sg - sa*sb*cg;
+}
 
-        THETA2j  = conversion(theta2j  ,0, -130);
-        THETA22j = conversion(theta22j ,0, -130);    
-        
-    }
 
-    double THETA2k;
-    double THETA22k;
-    if(theta33i == NOSOLUTION) {
-     } else {
-        temp1 = atan2(D4_A3 * sin(zeta1i) , settings.robot_qinnew.A2 + D4_A3 * cos(zeta1i));
-        double theta2k  = THE2(xtip,ytip,ztip,theta11,zeta1i,temp1);
-        double theta22k = THE2COMP(xtip,ytip,ztip,theta11,zeta1i,temp1);
+// Returns the rotation matrix of the unit quaternion q (w,x,y,z).
+static void quaternion_matrix(const float *q, double R[3][3])
+{
+  float w = q[0], x = q[1], y = q[2], z = q[3];
+  R[0][0] = 1 - 2*(y*y + z*z); R[0][1] = 2*(x*y - w*z);     R[0][2] = 2*(x*z + w*y);
+  R[1][0] = 2*(x*y + w*z);     R[1][1] = 1 - 2*(x*x + z*z); R[1][2] = 2*(y*z - w*x);
+  R[2][0] = 2*(x*z - w*y);     R[2][1] = 2*(y*z + w*x);     R[2][2] = 1 - 2*(x*x + y*y);
+}
 
-        THETA2k  = conversion(theta2k  ,0, -130);
-        THETA22k = conversion(theta22k ,0, -130);
-    }
-   
-
-    temp1 = cos(theta1);
-    temp2 = sin(theta1);
-    temp3 = cos(theta2i+theta33);
-    temp4 = sin(theta2i+theta33);
-    double R30[3][3] = { 
-                        { temp1 * temp3 , -temp1 * temp4 , -temp2},     
-                        { temp2 * temp3 , -temp2 * temp4 , temp1},     
-                        {-temp4         , -temp3         , 0    }
-                       };
-    double RT30[3][3];
-    double R63_cita456[3][3] = {{1,0,0},
-                                {0,0,-1},
-                                {0,1,0}}; 
-    double RT63_cita456[3][3] ={{1,0,0},
-                                {0,0,1},
-                                {0,-1,0}}; 
-    transpose(RT30[0],R30[0],3);
-    double R63[3][3];
-    double Rtemp[3][3];
-    MatrixMult(Rtemp[0],RT63_cita456[0],RT30[0],3);     
-    MatrixMult(R63[0],Rtemp[0],R60[0],3);              
-    
-    double g11 = R63[0][0];                             
-    double g12 = R63[0][1];
-    double g13 = R63[0][2];
-    double g23 = R63[1][2];
-    double g21 = R63[1][0];
-    double g22 = R63[1][1];
-    
-    double g31 = R63[2][0];
-    double g32 = R63[2][1];
-    double g33 = R63[2][2];
-    
-    double theta5 = atan2(N_SQRT(pow(g31,2) + pow(g32,2)), g33);
-    
-    double THETA4,theta4;
-    double THETA5;
-    double THETA6,theta6;
-    
-    temp1 = fabs(theta5 - pi);      
-    if(theta5 < 0.0001) {
-        THETA4= 0;
-        THETA5= 0;
-        theta6=  atan2(-g12, g11);   
-        THETA6=  theta6*180/pi;   
-        
-    } else if(temp1 < 0.0001) {
-        THETA4=  0;
-        THETA5=  0;
-        theta6 = atan2 (g12,-g11);
-				THETA6=  theta6*180/pi;
-        
-    } else {
-        temp1 = sin(theta5);
-     
-        theta4 = - atan2 (g23/ temp1, g13/ temp1);
-				theta6 = atan2((g32/ temp1), (- g31/ temp1));
-				THETA4=  conversion( theta4,180,-180);
-				THETA5=  conversion( theta5,120,-90);
-				THETA6=  conversion( theta6,180,-180);
-        
-        double theta44 =  theta4 + pi;
-        double theta55 = -theta5;
-        double theta66 =  theta6 + pi;
-        double THETA44 = conversion(theta44 , 180 , -180);        
-        double THETA55 = conversion(theta55 , 120 , -90);        
-        double THETA66 = conversion(theta66 , 180 , -180);
-        
-        
+
+// Returns the tool point and orientation at 'fraction' of the way along a Cartesian line. The point
+// moves linearly. The orientation turns about one fixed axis at a constant rate (quaternion SLERP),
+// which is the shortest turn between the end orientations and costs one sin/cos pair per point.
+// Only the orientation is given if 'position' is NULL.
+static void cartesian_line_frame(const cartesian_line_t *line, float fraction, float *position, double R[3][3])
+{
+  uint8_t idx;
+  if (position) {
+    for (idx=X_Cartesian; idx<=Z_Cartesian; idx++) {
+      position[idx] = line->start.coord[idx] + (line->target.coord[idx]-line->start.coord[idx]) * fraction;
     }
-#ifdef debug
-  printString("\r\n");
-  printString("THETA1:");
-  printFloat(THETA1,2);
-  printString("\r\n");
-  printString("THETA2i:");
-  printFloat(THETA2i+90,2);
-  printString("\r\n");
-  printString("THETA33:");
-  printFloat(THETA33,2);
-  printString("\r\n");
-  printString("THETA4:");
-  printFloat(THETA4,2);
-  printString("\r\n");
-  printString("THETA5:");
-  printFloat(THETA5-90,2);
-  printString("\r\n");
-  printString("THETA6:");
-  printFloat(THETA6,2);
-  printString("\r\n");
-#endif
-if((THETA1 == 1000)||(THETA1 == 1001)||(THETA2i == 1000)||(THETA2i == 1001)||(theta33 == 1000)||(THETA33 == 1001)||\
-	(THETA4 == 1000)||(THETA4 == 1001)||(THETA5 == 1000)||(THETA5 == 1001)||(THETA6 == 1000)||(THETA6 == 1001))
-	{
-	printString("\r\nThere is one angle out of limit!!!\r\n");
-	return;
-	}
+  }
 
-  gc_state.position[E_AXIS] = THETA1;//x 
-  gc_state.position[F_AXIS] = (THETA2i + 90);//y
-  gc_state.position[G_AXIS] = THETA33;//z 
-  gc_state.position[A_AXIS] = THETA4;//A 
-  gc_state.position[B_AXIS] = (THETA5 - 90);//B 
-  gc_state.position[C_AXIS] = THETA6;//C 
+  if (line->turn == 0.0) { memcpy(R, line->R, sizeof(line->R)); return; }
+
+  // q = (cos(a/2), sin(a/2)*axis) * q0
+  float half = 0.5*line->turn*fraction;
+  float c = KIN_COS(half), s = KIN_SIN(half);
+  const float *k = line->axis, *q0 = line->q0;
+  float q[4];
+  q[0] = c*q0[0] - s*(k[0]*q0[1] + k[1]*q0[2] + k[2]*q0[3]);
+  q[1] = c*q0[1] + s*(k[0]*q0[0] + k[1]*q0[3] - k[2]*q0[2]);
+  q[2] = c*q0[2] + s*(k[1]*q0[0] + k[2]*q0[1] - k[0]*q0[3]);
+  q[3] = c*q0[3] + s*(k[2]*q0[0] + k[0]*q0[2] - k[1]*q0[1]);
+  quaternion_matrix(q, R);
+}
 
 
+// Starts tracing a Cartesian line. 'angle' are the joint angles the arm holds at the start pose and
+// 'config' the IK_CONFIG_* solution to hold along it.
+void cartesian_line_init(cartesian_line_t *line, const pose_t *start, const pose_t *target, const float *angle,
+                         uint8_t config)
+{
+  memcpy(&line->start, start, sizeof(pose_t));
+  memcpy(&line->target, target, sizeof(pose_t));
+  memcpy(line->joint.angle, angle, sizeof(line->joint.angle));
+  line->t = 0.0;
+  line->dt = 1.0;
+  line->end = 1.0;
+  line->config = config;
+
+  // Orientation turn: qrel = q1*conj(q0) = (cos(turn/2), sin(turn/2)*axis), taken the short way round.
+  float q1[4];
+  pose_quaternion(start, line->q0);
+  pose_quaternion(target, q1);
+  float *q0 = line->q0;
+  float w = q1[0]*q0[0] + q1[1]*q0[1] + q1[2]*q0[2] + q1[3]*q0[3];
+  float x = -q1[0]*q0[1] + q1[1]*q0[0] - q1[2]*q0[3] + q1[3]*q0[2];
+  float y = -q1[0]*q0[2] + q1[1]*q0[3] + q1[2]*q0[0] - q1[3]*q0[1];
+  float z = -q1[0]*q0[3] - q1[1]*q0[2] + q1[2]*q0[1] + q1[3]*q0[0];
+  if (w < 0) { w = -w; x = -x; y = -y; z = -z; }
+  float s = sqrt(x*x + y*y + z*z);
+  line->turn = 2*atan2(s, w);
+  if (s > 0) { s = 1/s; }
+  line->axis[0] = x*s; line->axis[1] = y*s; line->axis[2] = z*s;
+  // Fixed orientation: R60 is the same for every point of the line, so form it once here.
+  if (line->turn == 0.0) { quaternion_matrix(q0, line->R); }
+
+  // Length F applies to: the tool point travel, or for a pure reorientation the turn in degrees.
+  float delta[3];
+  uint8_t idx;
+  for (idx=X_Cartesian; idx<=Z_Cartesian; idx++) { delta[idx] = target->coord[idx] - start->coord[idx]; }
+  line->length = sqrt(delta[X_Cartesian]*delta[X_Cartesian] + delta[Y_Cartesian]*delta[Y_Cartesian] +
+                      delta[Z_Cartesian]*delta[Z_Cartesian]);
+  if (line->length == 0.0) {
+    line->length = line->turn*180/pi;
+    if (line->length == 0.0) { line->length = 1.0; } // Moves only the D axis. Time it as 1mm.
+  }
 }
 
-void Forward(double *angle)
+
+// Returns the inverse time feed (1/min) that runs the last chord from cartesian_line_next() at the
+// Cartesian feed rate F, in mm/min or, with 'invert_feed_rate', as G93 1/min for the whole line.
+// The planner treats a joint feed as a speed along the joint vector, so the tool speed it gives
+// changes with the arm pose. Timing each chord directly keeps the tool at F wherever the joints'
+// max rates allow. For the chord's joint vector this is the mean of J^-1*v over it, exact for the
+// chord rather than only at one end of it, and costs no extra trig.
+float cartesian_line_feed(cartesian_line_t *line, float feed_rate, uint8_t invert_feed_rate)
 {
-	for(int m =0;m<7;m++)
-	{
-	   if(m == F_AXIS)
-	   	angle[m] = angle[m] - 90;
-	   if(m == B_AXIS)
-	   	angle[m] = angle[m] + 90;
-	   
-		angle[m] = angle[m] * pi/180;
-		}
-	
-	double sin1 = sin(angle[4]);
-	double cos1 = cos(angle[4]);
-	
-	double sin2 = sin(angle[5]);
-	double cos2 = cos(angle[5]);
-	
-	double sin3 = sin(angle[6]);
-	double cos3 = cos(angle[6]);
-	
-	double sin4 = sin(angle[0]);
-	double cos4 = cos(angle[0]);
-	
-	double sin5 = sin(angle[1]);
-	double cos5 = cos(angle[1]);
-	
-	double sin6 = sin(angle[2]);
-	double cos6 = cos(angle[2]);
-	
-	double T10[4][4] = { 
-                        { cos1, -sin1 , 0,  0},      
-                        { sin1,  cos1 , 0,  0},      
-                        {    0,     0 , 1, settings.robot_qinnew.D1},
-                        {    0,     0 , 0,  1}
-                       }; 
-	double T21[4][4] = { 
-                        { cos2, -sin2 , 0, settings.robot_qinnew.A1},      
-                        {    0,     0 , 1,  0},      
-                        {-sin2, -cos2 , 0,  0},
-                        {    0,     0 , 0,  1}
-                       };
-  double T32[4][4] = { 
-                        { cos3, -sin3 , 0, settings.robot_qinnew.A2},      
-                        { sin3,  cos3 , 0,  0},      
-                        {    0,     0 , 1,  0},
-                        {    0,     0 , 0,  1}
-                       };
-  double T43[4][4] = { 
-                        { cos4, -sin4 , 0, settings.robot_qinnew.A3},      
-                        {    0,     0 , 1, settings.robot_qinnew.D4},      
-                        {-sin4, -cos4 , 0,  0},
-                        {    0,     0 , 0,  1}
-                       };              
-  double T54[4][4] = { 
-                        { cos5, -sin5 , 0,  0},      
-                        {    0,     0 ,-1,  0},      
-                        { sin5,  cos5 , 0,  0},
-                        {    0,     0 , 0,  1}
-                       };                
-	double T65[4][4] = { 
-                        { cos6, -sin6 , 0,  0},      
-                        {    0,     0 ,-1, -settings.robot_qinnew.L},      
-                        { sin6,  cos6 , 0,  0},
-                        {    0,     0 , 0,  1}
-                       }; 
-  double temp1[4][4];
-  double temp2[4][4];
-  //Serial.print("T10:");output(T10);
-  MatrixMult(temp1[0],T10[0],T21[0],4);
-  // Serial.print("T20:");output(temp1);
-  MatrixMult(temp2[0],temp1[0],T32[0],4);
-  // Serial.print("T30:");output(temp2);
-  MatrixMult(temp1[0],temp2[0],T43[0],4);
-  // Serial.print("T40:");output(temp1);
-  MatrixMult(temp2[0],temp1[0],T54[0],4);
-  // Serial.print("T50:");output(temp2);
-  MatrixMult(temp1[0],temp2[0],T65[0],4);
-  // Serial.print("T60:");output(temp1);
-  
-  double temp = sqrt(pow(temp1[2][1],2)+pow(temp1[2][2],2));
-  sys.position_Cartesian[RX_Cartesian] = atan2(temp1[2][1],temp1[2][2])*180/pi;
-  sys.position_Cartesian[RY_Cartesian] = atan2(-temp1[2][0],temp)*180/pi;
-  sys.position_Cartesian[RZ_Cartesian] = atan2(temp1[1][0],temp1[0][0])*180/pi;
-
-  sys.position_Cartesian[X_Cartesian] = temp1[0][3];
-  sys.position_Cartesian[Y_Cartesian] = temp1[1][3];
-  sys.position_Cartesian[Z_Cartesian] = temp1[2][3];
-  
-	}
+  if (invert_feed_rate) { return(feed_rate/line->dt); }
+  return(feed_rate/(line->length*line->dt));
+}
+
+
+// Solves the joints for the tool point at 'position' with the line's orientation at 'fraction', and
+// advances the line there. Used by Cartesian arcs, which place the tool point themselves and only
+// take the orientation from the line.
+uint8_t cartesian_line_solve(cartesian_line_t *line, float fraction, const float *position)
+{
+  double R[3][3];
+  joint_t joint;
+  memcpy(joint.angle, line->joint.angle, sizeof(joint.angle));
+  cartesian_line_frame(line, fraction, NULL, R);
+  uint8_t status = ik_solve_frame(position, R, line->config, &joint);
+  if (status) { return(status); }
+  line->dt = fraction-line->t;
+  line->t = fraction;
+  memcpy(line->joint.angle, joint.angle, sizeof(line->joint.angle));
+  return(STATUS_OK);
+}
+
+// Advances the line by one joint-space chord and leaves its end joints in line->joint. The planner
+// moves all joints linearly, so the tool wanders off the Cartesian line in between IK points. Each
+// chord is made as long as possible while the tool point at the chord's joint midpoint stays within
+// $46 (path_tolerance) of the ideal line point, halving it until it does. The next chord starts from
+// twice the last accepted one, so straight stretches quickly get long chords again. A chord that would
+// leave less than half of CARTESIAN_MIN_CHORD to the end is stretched to the end.
+uint8_t cartesian_line_next(cartesian_line_t *line)
+{
+  float dt = min(2*line->dt, line->end-line->t);
+  if (!settings.robot_qinnew.use_interpolation) { dt = line->end-line->t; }
+
+  pose_t fk_pose;
+  joint_t joint;
+  float position[3], mid[N_AXIS];
+  double R[3][3];
+  uint8_t idx, status;
+  memcpy(joint.angle, line->joint.angle, sizeof(joint.angle));
+  for (;;) {
+    cartesian_line_frame(line, line->t+dt, position, R);
+    status = ik_solve_frame(position, R, line->config, &joint);
+    if (status) { return(status); }
+    if (!settings.robot_qinnew.use_interpolation || (dt <= CARTESIAN_MIN_CHORD)) { break; }
+
+    for (idx=0; idx<N_AXIS; idx++) { mid[idx] = 0.5*(line->joint.angle[idx] + joint.angle[idx]); }
+    fk_solve(mid, &fk_pose);
+    float fraction = line->t+0.5*dt;
+    float dx = fk_pose.coord[X_Cartesian] - (line->start.coord[X_Cartesian] + (line->target.coord[X_Cartesian]-line->start.coord[X_Cartesian]) * fraction);
+    float dy = fk_pose.coord[Y_Cartesian] - (line->start.coord[Y_Cartesian] + (line->target.coord[Y_Cartesian]-line->start.coord[Y_Cartesian]) * fraction);
+    float dz = fk_pose.coord[Z_Cartesian] - (line->start.coord[Z_Cartesian] + (line->target.coord[Z_Cartesian]-line->start.coord[Z_Cartesian]) * fraction);
+    if ((dx*dx + dy*dy + dz*dz) <= (settings.robot_qinnew.path_tolerance*settings.robot_qinnew.path_tolerance)) { break; }
+    dt *= 0.5;
+  }
+
+  if ((dt != line->end-line->t) && ((line->t+dt) > (line->end-0.5*CARTESIAN_MIN_CHORD))) {
+    dt = line->end-line->t;
+    cartesian_line_frame(line, line->end, position, R);
+    status = ik_solve_frame(position, R, line->config, &joint);
+    if (status) { return(status); }
+  }
+  if (dt == line->end-line->t) { line->t = line->end; } // Solved at the end. Avoids float round-off.
+  else { line->t += dt; }
+  line->dt = dt;
+  memcpy(line->joint.angle, joint.angle, sizeof(line->joint.angle));
+  return(STATUS_OK);
+}
+
 
+#ifndef KINEMATICS_TEST_TIMER
+  #error "The $K kinematics self test needs a free 16-bit timer, KINEMATICS_TEST_TIMER in the cpu_map."
+#endif
+#if (KINEMATICS_TEST_TIMER == 0) || (KINEMATICS_TEST_TIMER == 1) || (KINEMATICS_TEST_TIMER == 2)
+  #error "KINEMATICS_TEST_TIMER may not be a stepper timer."
+#endif
+#if (defined(VARIABLE_SPINDLE) && (KINEMATICS_TEST_TIMER == SPINDLE_PWM_TIMER)) || \
+    (defined(VARIABLE_SPINDLE_2) && (KINEMATICS_TEST_TIMER == SPINDLE_PWM_TIMER_2))
+  #error "KINEMATICS_TEST_TIMER may not be a spindle PWM timer."
+#endif
+
+// Reads the self test timer. The 16-bit read shares the TEMP register with the 16-bit timer writes
+// of the stepper interrupt, so it must not be interrupted.
+static uint16_t kinematics_test_ticks()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t ticks = KINEMATICS_TEST_TCNT;
+  SREG = sreg;
+  return(ticks);
+}
+
+
+// Kinematics self test for $K. Sweeps a grid of joint vectors over each joint's soft limit travel,
+// takes the forward pose of each and solves it back with ik_solve(), and collects the worst
+// FK(IK(p)) error and the mean solve times. Gives a regression check for kinematics changes and the
+// solve rate, which bounds how many Cartesian points per second the firmware can afford. Timed with
+// the KINEMATICS_TEST_TIMER of the cpu_map at 4us resolution, whose registers are restored after.
+// Blocks for several seconds.
+void kinematics_self_test(kinematics_test_t *result)
+{
+  const uint8_t axes[6] = { E_AXIS, F_AXIS, G_AXIS, A_AXIS, B_AXIS, C_AXIS };
+  uint8_t index[6] = { 0, 0, 0, 0, 0, 0 };
+  uint32_t ik_ticks = 0, fk_ticks = 0;
+  uint16_t tick;
+  uint8_t idx;
+  memset(result, 0, sizeof(kinematics_test_t));
+
+  uint8_t tccra = KINEMATICS_TEST_TCCRA, tccrb = KINEMATICS_TEST_TCCRB;
+  uint16_t tcnt = kinematics_test_ticks();
+  KINEMATICS_TEST_TCCRA = 0;
+  KINEMATICS_TEST_TCCRB = KINEMATICS_TEST_PRESCALER;
+  for (;;) {
+    joint_t grid, solved;
+    pose_t pose, check;
+    memset(&grid, 0, sizeof(grid));
+    for (idx=0; idx<6; idx++) {
+      float lo = -settings.min_travel[axes[idx]], hi = settings.max_travel[axes[idx]];
+      grid.angle[axes[idx]] = lo + (hi-lo)*(index[idx]+0.5)/KINEMATICS_TEST_STEPS;
+    }
+    memcpy(&solved, &grid, sizeof(joint_t));
+
+    tick = kinematics_test_ticks();
+    fk_solve(grid.angle, &pose);
+    fk_ticks += (uint16_t)(kinematics_test_ticks() - tick);
+    tick = kinematics_test_ticks();
+    uint8_t status = ik_solve(&pose, IK_CONFIG_NEAREST, &solved);
+    ik_ticks += (uint16_t)(kinematics_test_ticks() - tick);
+    result->solves++;
+
+    if (status) {
+      result->failures++;
+    } else {
+      fk_solve(solved.angle, &check);
+      float dx = check.coord[X_Cartesian] - pose.coord[X_Cartesian];
+      float dy = check.coord[Y_Cartesian] - pose.coord[Y_Cartesian];
+      float dz = check.coord[Z_Cartesian] - pose.coord[Z_Cartesian];
+      result->position_error = max(result->position_error, sqrt(dx*dx + dy*dy + dz*dz));
+      // Orientation error as the turn between the two frames, 2*asin(|v|) of the vector part v of
+      // q2*conj(q1). Unlike acos(q1.q2) this keeps its resolution for small turns.
+      float q1[4], q2[4];
+      pose_quaternion(&pose, q1);
+      pose_quaternion(&check, q2);
+      float x = -q2[0]*q1[1] + q2[1]*q1[0] - q2[2]*q1[3] + q2[3]*q1[2];
+      float y = -q2[0]*q1[2] + q2[1]*q1[3] + q2[2]*q1[0] - q2[3]*q1[1];
+      float z = -q2[0]*q1[3] - q2[1]*q1[2] + q2[2]*q1[1] + q2[3]*q1[0];
+      float v = min(sqrt(x*x + y*y + z*z), 1.0);
+      result->orientation_error = max(result->orientation_error, 2*asin(v)*180/pi);
+    }
+
+    // Next grid point, odometer style.
+    for (idx=0; idx<6; idx++) {
+      if (++index[idx] < KINEMATICS_TEST_STEPS) { break; }
+      index[idx] = 0;
+    }
+    if (idx == 6) { break; }
+  }
+  KINEMATICS_TEST_TCCRB = 0; // Stopped while the counter is restored.
+  uint8_t sreg = SREG;
+  cli();
+  KINEMATICS_TEST_TCNT = tcnt;
+  SREG = sreg;
+  KINEMATICS_TEST_TCCRA = tccra;
+  KINEMATICS_TEST_TCCRB = tccrb;
+
+  result->ik_us = 4.0*ik_ticks/result->solves;
+  result->fk_us = 4.0*fk_ticks/result->solves;
+}
 
 
 void go_reset_pos()
@@ -444,26 +745,26 @@ void go_reset_pos()
 				temp[idx] =  settings.Reset[idx];
 	}
 	sys.home_complate_flag = 1;
-	mc_line(temp, -1.0, false ,false);
+	mc_line(temp, -1.0, false);
 	
 	//printString("in homeing moving...");
 }
 
 void angle_to_coordinate()
 {
-	double temp[N_AXIS];
-	system_convert_array_steps_to_mpos(temp,sys.position);
-	Forward(temp);
-	gc_state.position_Cartesian[E_AXIS] = sys.position_Cartesian[X_Cartesian];
-	gc_state.position_Cartesian[F_AXIS] = sys.position_Cartesian[Y_Cartesian];
-	gc_state.position_Cartesian[G_AXIS] = sys.position_Cartesian[Z_Cartesian];
-	printString_debug("\r\gc_state.position_Cartesian[G_AXIS]:");
-
-	gc_state.position_Cartesian[D_AXIS] = temp[D_AXIS];
+	uint8_t idx;
+	pose_t pose;
+	fk_solve_steps(sys.position, &pose);
+	for (idx=0; idx<N_Cartesian; idx++) { sys.position_Cartesian[idx] = pose.coord[idx]; }
+	gc_state.position_Cartesian[E_AXIS] = pose.coord[X_Cartesian];
+	gc_state.position_Cartesian[F_AXIS] = pose.coord[Y_Cartesian];
+	gc_state.position_Cartesian[G_AXIS] = pose.coord[Z_Cartesian];
+
+	gc_state.position_Cartesian[D_AXIS] = system_convert_axis_steps_to_mpos(sys.position, D_AXIS);
 	
-	gc_state.position_Cartesian[A_AXIS] = sys.position_Cartesian[RX_Cartesian];
-	gc_state.position_Cartesian[B_AXIS] = sys.position_Cartesian[RY_Cartesian];
-	gc_state.position_Cartesian[C_AXIS] = sys.position_Cartesian[RZ_Cartesian];
+	gc_state.position_Cartesian[A_AXIS] = pose.coord[RX_Cartesian];
+	gc_state.position_Cartesian[B_AXIS] = pose.coord[RY_Cartesian];
+	gc_state.position_Cartesian[C_AXIS] = pose.coord[RZ_Cartesian];
 
 }
 void coordinate_to_angle()
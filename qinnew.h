@@ -12,7 +12,7 @@
 
 // Version of the EEPROM data. Will be used to migrate existing data from older versions of Grbl
 // when firmware is upgraded. Always stored in byte 0 of eeprom
-#define SETTINGS_VERSION 6
+#define SETTINGS_VERSION 11
 
 #define minirobot
 
@@ -30,15 +30,83 @@ typedef struct {
   float offset[N_AXIS];
 
   uint8_t use_interpolation;
-  uint8_t interpolation_num;
-
-  uint8_t use_compensation;
-  uint8_t compensation_num;
+  float path_tolerance;     // Max tool deviation from a Cartesian line between IK points, in mm
+  float tool_acceleration;  // Tool point acceleration of Cartesian moves in mm/min^2, 0 plans them in joint space
 
   uint8_t use_reset_pos;
   uint8_t use_Back_to_text;
 } robot_t;
 
+// Constants derived from the robot_t link lengths. Computed by InverseInit() at settings_init() and
+// again whenever a geometry setting ($40-$45) changes, so ik_solve_frame() never recomputes them.
+typedef struct {
+  double D1xD1;
+  double A1xA1;
+  double A2xA2;
+  double A3xA3;
+  double D4xD4;
+  double D4_A3;           // sqrt(D4^2 + A3^2), forearm length from joint 3 to the wrist center
+  double ATAN2D4_A3;      // atan2(D4,A3), forearm elbow offset angle
+  double czeta_offset;    // A2^2 + D4^2 + A3^2, constant term of the law of cosines for theta3
+  double inv_2xA2xD4_A3;  // 1/(2*A2*D4_A3)
+  double L_abs;           // |L|, tool length along the flange z axis
+  double reach_min_sq;    // (A2-D4_A3)^2 and (A2+D4_A3)^2, the squared distance range from joint 2
+  double reach_max_sq;    // to the wrist center the elbow can span
+  uint8_t fk_valid;       // Cached fk_solve_steps() pose is current. Cleared on geometry or steps/mm change.
+} kinematics_t;
+extern kinematics_t kin;
+
+// Cartesian tool pose, indexed by X_Cartesian..RZ_Cartesian. Position in mm, fixed-axis rotation in degrees.
+typedef struct {
+  float coord[N_Cartesian];
+} pose_t;
+
+// Joint angles in degrees, indexed by machine axis (A_AXIS..G_AXIS), ready for mc_line().
+typedef struct {
+  float angle[N_AXIS];
+} joint_t;
+
+// IK solution branches, as bits of the L word of an M20 G0/G1. ik_solve() picks the solution nearest
+// the current joints when no L word is given.
+#define IK_CONFIG_SHOULDER_BACK bit(0)  // Joint 1 turned away from the target, arm reaching over backwards
+#define IK_CONFIG_ELBOW_DOWN    bit(1)  // Elbow below the shoulder-wrist line
+#define IK_CONFIG_WRIST_FLIP    bit(2)  // Joint 5 negated, joints 4 and 6 turned half a turn
+#define IK_CONFIG_MAX           7
+#define IK_CONFIG_NEAREST       0xFF
+
+// Shortest chord cartesian_line_next() will split a line into, as a fraction of the line. Bounds
+// the work near singularities, where no chord length meets the path tolerance.
+#define CARTESIAN_MIN_CHORD (1.0/1024)
+
+// State of a Cartesian line being traced as joint-space chords.
+typedef struct {
+  pose_t start;
+  pose_t target;
+  float t;          // Fraction of the line traced so far
+  float dt;         // Last accepted chord as a fraction of the line
+  float end;        // Fraction cartesian_line_next() stops at, normally 1.0. See G64 blending.
+  joint_t joint;    // Joint angles at t
+  uint8_t config;   // IK_CONFIG_* bits, or IK_CONFIG_NEAREST
+  float length;     // Tool travel in mm, or turn in degrees if the tool point stays put
+  float q0[4];      // Start orientation as a unit quaternion (w,x,y,z)
+  float axis[3];    // Fixed axis the orientation turns about, base frame
+  float turn;       // Total turn about 'axis' in radians, 0..pi
+  double R[3][3];   // R60 of the whole line when turn is 0
+} cartesian_line_t;
+
+// Result of the $K kinematics self test, see kinematics_self_test().
+typedef struct {
+  uint16_t solves;          // Poses solved
+  uint16_t failures;        // Poses ik_solve() returned an error for
+  float ik_us;              // Mean ik_solve() time in microseconds
+  float fk_us;              // Mean fk_solve() time in microseconds
+  float position_error;     // Worst FK(IK(p)) tool point error in mm
+  float orientation_error;  // Worst FK(IK(p)) orientation error in degrees
+} kinematics_test_t;
+
+// Joint grid points per joint swept by $K. Solves KINEMATICS_TEST_STEPS^6 poses.
+#define KINEMATICS_TEST_STEPS 3
+
 
 #define QINNEW_VERSION "20191228_2"
 
@@ -61,10 +129,18 @@ typedef struct {
 
 //#define debug
 
-void Inverse(double x_wrist,double y_wrist,double z_wrist,double alpha,double beta,double gama);
+uint8_t ik_solve(const pose_t *pose, uint8_t config, joint_t *joint);
+uint8_t ik_reachable(const pose_t *pose);
 void InverseInit(void);
 void go_reset_pos();
-void Forward(double *angle);
+void fk_solve(const float *angle, pose_t *out);
+void fk_solve_steps(int32_t *steps, pose_t *out);
+void cartesian_line_init(cartesian_line_t *line, const pose_t *start, const pose_t *target, const float *angle,
+                         uint8_t config);
+uint8_t cartesian_line_next(cartesian_line_t *line);
+uint8_t cartesian_line_solve(cartesian_line_t *line, float fraction, const float *position);
+float cartesian_line_feed(cartesian_line_t *line, float feed_rate, uint8_t invert_feed_rate);
+void kinematics_self_test(kinematics_test_t *result);
 void angle_to_coordinate();
 void coordinate_to_angle();
 void start_calibration();
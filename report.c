@@ -85,6 +85,10 @@ void report_status_message(uint8_t status_code)
           case STATUS_MAX_STEP_RATE_EXCEEDED: 
           printPgmString(PSTR("Step rate > 30kHz")); break;
         #endif      
+        #ifdef INPUT_SHAPING
+          case STATUS_SETTING_INPUT_SHAPER:
+          printPgmString(PSTR("Shaper type > 3 or damping >= 1")); break;
+        #endif
         // Common g-code parser errors.
         case STATUS_GCODE_MODAL_GROUP_VIOLATION:
         printPgmString(PSTR("Modal group violation")); break;
@@ -92,6 +96,10 @@ void report_status_message(uint8_t status_code)
         printPgmString(PSTR("Unsupported command")); break;
         case STATUS_GCODE_UNDEFINED_FEED_RATE:
         printPgmString(PSTR("Undefined feed rate")); break;
+        case STATUS_GCODE_OUT_OF_WORKSPACE:
+        printPgmString(PSTR("Target out of workspace")); break;
+        case STATUS_GCODE_JOINT_LIMIT:
+        printPgmString(PSTR("Joint out of limit")); break;
         default:
           // Remaining g-code parser errors with error codes
           printPgmString(PSTR("Invalid gcode ID:"));
@@ -111,7 +119,12 @@ void report_alarm_message(int8_t alarm_code)
   #else
     switch (alarm_code) {
       case ALARM_HARD_LIMIT_ERROR: 
-      printPgmString(PSTR("Hard limit")); break;
+      printPgmString(PSTR("Hard limit"));
+      if (sys.hard_limit_trigger_flag) { // Engaged switches, by axis bit. Set by the limit interrupt.
+        printPgmString(PSTR(" ")); 
+        print_uint8_base2(sys.hard_limit_trigger_flag); 
+      }
+      break;
       case ALARM_SOFT_LIMIT_ERROR:
       printPgmString(PSTR("Soft limit")); break;
       case ALARM_ABORT_CYCLE: 
@@ -206,11 +219,6 @@ void report_robot_length_message()
   if(settings.robot_qinnew.use_reset_pos)
 		printString("\r\nUsing reset pos!\r\n");
 
-  #ifdef _use_compensation_
-		printString("\r\nUsing compensation in X axis:");
-  		printInteger(settings.robot_qinnew.compensation_num);printString(" steps");
-  #endif
-
  
 }
 
@@ -228,6 +236,7 @@ void report_grbl_help() {
                         "$C (check gcode mode)\r\n"
                         "$X (kill alarm lock)\r\n"
                         "$H (run homing cycle)\r\n"
+                        "$K (kinematics self test)\r\n"
                         "~ (cycle start)\r\n"
                         "! (feed hold)\r\n"
                         "? (current status)\r\n"
@@ -252,6 +261,12 @@ void report_grbl_settings() {
     printPgmString(PSTR("\r\n$11=")); printFloat_SettingValue(settings.junction_deviation);
     printPgmString(PSTR("\r\n$12=")); printFloat_SettingValue(settings.arc_tolerance);
     printPgmString(PSTR("\r\n$13=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_REPORT_INCHES));
+    #ifdef S_CURVE_ACCELERATION
+      printPgmString(PSTR("\r\n$14=")); printFloat_SettingValue(settings.jerk/(60*60*60));
+    #endif
+    #ifdef INPUT_SHAPING
+      printPgmString(PSTR("\r\n$15=")); print_uint8_base10(settings.shaper_type);
+    #endif
     printPgmString(PSTR("\r\n$20=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_SOFT_LIMIT_ENABLE));
     printPgmString(PSTR("\r\n$21=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_HARD_LIMIT_ENABLE));
     printPgmString(PSTR("\r\n$22=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_HOMING_ENABLE));
@@ -260,6 +275,15 @@ void report_grbl_settings() {
     printPgmString(PSTR("\r\n$25=")); printFloat_SettingValue(settings.homing_seek_rate);
     printPgmString(PSTR("\r\n$26=")); print_uint8_base10(settings.homing_debounce_delay);
     printPgmString(PSTR("\r\n$27=")); printFloat_SettingValue(settings.homing_pulloff);
+    printPgmString(PSTR("\r\n$28=")); print_uint8_base10(settings.homing_pos_dir_mask);
+    printPgmString(PSTR("\r\n$40=")); printFloat_SettingValue(settings.robot_qinnew.D1);
+    printPgmString(PSTR("\r\n$41=")); printFloat_SettingValue(settings.robot_qinnew.A1);
+    printPgmString(PSTR("\r\n$42=")); printFloat_SettingValue(settings.robot_qinnew.A2);
+    printPgmString(PSTR("\r\n$43=")); printFloat_SettingValue(settings.robot_qinnew.A3);
+    printPgmString(PSTR("\r\n$44=")); printFloat_SettingValue(settings.robot_qinnew.D4);
+    printPgmString(PSTR("\r\n$45=")); printFloat_SettingValue(settings.robot_qinnew.L);
+    printPgmString(PSTR("\r\n$46=")); printFloat_SettingValue(settings.robot_qinnew.path_tolerance);
+    printPgmString(PSTR("\r\n$47=")); printFloat_SettingValue(settings.robot_qinnew.tool_acceleration/(60*60));
     printPgmString(PSTR("\r\n"));
   #else      
     printPgmString(PSTR("$0=")); print_uint8_base10(settings.pulse_microseconds);
@@ -276,7 +300,16 @@ void report_grbl_settings() {
     printPgmString(PSTR(")\r\n$11=")); printFloat_SettingValue(settings.junction_deviation);
     printPgmString(PSTR(" (junction deviation, mm)\r\n$12=")); printFloat_SettingValue(settings.arc_tolerance);
     printPgmString(PSTR(" (arc tolerance, mm)\r\n$13=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_REPORT_INCHES));
-    printPgmString(PSTR(" (report inches, bool)\r\n$20=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_SOFT_LIMIT_ENABLE));
+    printPgmString(PSTR(" (report inches, bool)"));
+    #ifdef S_CURVE_ACCELERATION
+      printPgmString(PSTR("\r\n$14=")); printFloat_SettingValue(settings.jerk/(60*60*60));
+      printPgmString(PSTR(" (jerk, mm/sec^3)"));
+    #endif
+    #ifdef INPUT_SHAPING
+      printPgmString(PSTR("\r\n$15=")); print_uint8_base10(settings.shaper_type);
+      printPgmString(PSTR(" (input shaper, 0=off 1=ZV 2=ZVD 3=EI)"));
+    #endif
+    printPgmString(PSTR("\r\n$20=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_SOFT_LIMIT_ENABLE));
     printPgmString(PSTR(" (soft limits, bool)\r\n$21=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_HARD_LIMIT_ENABLE));
     printPgmString(PSTR(" (hard limits, bool)\r\n$22=")); print_uint8_base10(bit_istrue(settings.flags,BITFLAG_HOMING_ENABLE));
     printPgmString(PSTR(" (homing cycle, bool)\r\n$23=")); print_uint8_base10(settings.homing_dir_mask);
@@ -287,7 +320,15 @@ void report_grbl_settings() {
     printPgmString(PSTR(" (homing debounce, msec)\r\n$27=")); printFloat_SettingValue(settings.homing_pulloff);
     printPgmString(PSTR(" (homing pull-off, mm)\r\n$28="));print_uint8_base10(settings.homing_pos_dir_mask);
 	printPgmString(PSTR(" (homing pos dir invert mask:"));print_uint8_base2(settings.homing_pos_dir_mask);
-	printPgmString(PSTR(")\r\n"));
+	printPgmString(PSTR(")\r\n$40=")); printFloat_SettingValue(settings.robot_qinnew.D1);
+    printPgmString(PSTR(" (robot D1, mm)\r\n$41=")); printFloat_SettingValue(settings.robot_qinnew.A1);
+    printPgmString(PSTR(" (robot A1, mm)\r\n$42=")); printFloat_SettingValue(settings.robot_qinnew.A2);
+    printPgmString(PSTR(" (robot A2, mm)\r\n$43=")); printFloat_SettingValue(settings.robot_qinnew.A3);
+    printPgmString(PSTR(" (robot A3, mm)\r\n$44=")); printFloat_SettingValue(settings.robot_qinnew.D4);
+    printPgmString(PSTR(" (robot D4, mm)\r\n$45=")); printFloat_SettingValue(settings.robot_qinnew.L);
+    printPgmString(PSTR(" (robot tool length L, mm)\r\n$46=")); printFloat_SettingValue(settings.robot_qinnew.path_tolerance);
+    printPgmString(PSTR(" (Cartesian path tolerance, mm)\r\n$47=")); printFloat_SettingValue(settings.robot_qinnew.tool_acceleration/(60*60));
+    printPgmString(PSTR(" (Cartesian tool accel, mm/sec^2)\r\n"));
 	
   #endif
   
@@ -306,6 +347,11 @@ void report_grbl_settings() {
         case 3: printFloat_SettingValue(settings.max_travel[idx]); break;
 		case 4: printFloat_SettingValue(settings.min_travel[idx]); break;
 		case 5: printFloat_SettingValue(settings.Reset[idx]); break;
+		case 6: printFloat_SettingValue(settings.backlash[idx]); break;
+		#ifdef INPUT_SHAPING
+		  case 7: printFloat_SettingValue(settings.shaper_frequency[idx]); break;
+		  case 8: printFloat_SettingValue(settings.shaper_damping[idx]); break;
+		#endif
       }
       #ifdef REPORT_GUI_MODE
         printPgmString(PSTR("\r\n"));
@@ -327,6 +373,11 @@ void report_grbl_settings() {
           case 3: printPgmString(PSTR(" max travel, mm")); break;
 		  case 4: printPgmString(PSTR(" min travel, mm")); break;
 		  case 5: printPgmString(PSTR(" reset distance")); break;
+		  case 6: printPgmString(PSTR(" backlash, mm")); break;
+		  #ifdef INPUT_SHAPING
+		    case 7: printPgmString(PSTR(" shaper freq, Hz")); break;
+		    case 8: printPgmString(PSTR(" shaper damping")); break;
+		  #endif
         }      
         printPgmString(PSTR(")\r\n"));
       #endif
@@ -357,6 +408,26 @@ void report_probe_parameters()
 }
 
 
+// Prints the $K kinematics self test result: poses solved, IK failures, mean IK and FK times in
+// microseconds, and the worst FK(IK(p)) tool point (mm) and orientation (deg) errors.
+void report_kinematics_test(kinematics_test_t *result)
+{
+  printPgmString(PSTR("[KIN:"));
+  print_uint32_base10(result->solves);
+  printPgmString(PSTR(","));
+  print_uint32_base10(result->failures);
+  printPgmString(PSTR("|IK:"));
+  printFloat(result->ik_us, 0);
+  printPgmString(PSTR(",FK:"));
+  printFloat(result->fk_us, 0);
+  printPgmString(PSTR("|ERR:"));
+  printFloat(result->position_error, 4);
+  printPgmString(PSTR(","));
+  printFloat(result->orientation_error, 4);
+  printPgmString(PSTR("]\r\n"));
+}
+
+
 // Prints Grbl NGC parameters (coordinate offsets, probing)
 void report_ngc_parameters()
 {
@@ -426,6 +497,8 @@ void report_gcode_modes()
   
   if (gc_state.modal.feed_rate == FEED_RATE_MODE_INVERSE_TIME) { printPgmString(PSTR(" G93")); }
   else { printPgmString(PSTR(" G94")); }
+
+  if (gc_state.modal.control == CONTROL_MODE_CONTINUOUS) { printPgmString(PSTR(" G64")); }
     
   switch (gc_state.modal.program_flow) {
     case PROGRAM_FLOW_RUNNING : printPgmString(PSTR(" M0")); break;
@@ -501,8 +574,8 @@ void report_realtime_status()
   // for a user to select the desired real-time data.
   uint8_t idx;
   int32_t current_position[N_AXIS]; // Copy current state of the system position variable
-  memcpy(current_position,sys.position,sizeof(sys.position));
-  double print_position[N_AXIS];
+  st_get_position(current_position);
+  float print_position[N_AXIS];
  
   // Report current machine state
   switch (sys.state) {
@@ -531,9 +604,10 @@ void report_realtime_status()
     }
 
 	printPgmString(PSTR(",Cartesian coordinate(XYZ RxRyRz):")); 
-	Forward(print_position);
+	pose_t pose;
+	fk_solve_steps(current_position, &pose);
 	for (idx=0; idx< N_Cartesian; idx++) {
-      printFloat_CoordValue(sys.position_Cartesian[idx]);
+      printFloat_CoordValue(pose.coord[idx]);
       if (idx < (N_Cartesian-1)) { printPgmString(PSTR(",")); }
 	
   }
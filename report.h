@@ -34,6 +34,7 @@
 #define STATUS_SOFT_LIMIT_ERROR 10
 #define STATUS_OVERFLOW 11
 #define STATUS_MAX_STEP_RATE_EXCEEDED 12
+#define STATUS_SETTING_INPUT_SHAPER 13
 
 #define STATUS_GCODE_UNSUPPORTED_COMMAND 20
 #define STATUS_GCODE_MODAL_GROUP_VIOLATION 21
@@ -53,6 +54,8 @@
 #define STATUS_GCODE_NO_OFFSETS_IN_PLANE 35
 #define STATUS_GCODE_UNUSED_WORDS 36
 #define STATUS_GCODE_G43_DYNAMIC_AXIS_ERROR 37
+#define STATUS_GCODE_OUT_OF_WORKSPACE 38
+#define STATUS_GCODE_JOINT_LIMIT 39
 
 // Define Grbl alarm codes.
 #define ALARM_HARD_LIMIT_ERROR 1
@@ -101,6 +104,9 @@ void report_probe_parameters();
 // Prints Grbl NGC parameters (coordinate offsets, probe)
 void report_ngc_parameters();
 
+// Prints the $K kinematics self test result
+void report_kinematics_test(kinematics_test_t *result);
+
 // Prints current g-code parser mode state
 void report_gcode_modes();
 
@@ -65,6 +65,8 @@ void settings_restore(uint8_t restore_flag) {
 	settings.status_report_mask = DEFAULT_STATUS_REPORT_MASK;
 	settings.junction_deviation = DEFAULT_JUNCTION_DEVIATION;
 	settings.arc_tolerance = DEFAULT_ARC_TOLERANCE;
+	settings.jerk = DEFAULT_JERK;
+	settings.shaper_type = DEFAULT_SHAPER_TYPE;
 	settings.homing_dir_mask = DEFAULT_HOMING_DIR_MASK;
 	settings.homing_feed_rate = DEFAULT_HOMING_FEED_RATE;
 	settings.homing_seek_rate = DEFAULT_HOMING_SEEK_RATE;
@@ -126,6 +128,30 @@ void settings_restore(uint8_t restore_flag) {
   settings.Reset[F_AXIS] = DEFAULTS_RESET_F;
   settings.Reset[G_AXIS] = DEFAULTS_RESET_G;
 
+  settings.backlash[A_AXIS] = DEFAULT_A_BACKLASH;
+  settings.backlash[B_AXIS] = DEFAULT_B_BACKLASH;
+  settings.backlash[C_AXIS] = DEFAULT_C_BACKLASH;
+  settings.backlash[D_AXIS] = DEFAULT_D_BACKLASH;
+  settings.backlash[E_AXIS] = DEFAULT_E_BACKLASH;
+  settings.backlash[F_AXIS] = DEFAULT_F_BACKLASH;
+  settings.backlash[G_AXIS] = DEFAULT_G_BACKLASH;
+
+  settings.shaper_frequency[A_AXIS] = DEFAULT_A_SHAPER_FREQUENCY;
+  settings.shaper_frequency[B_AXIS] = DEFAULT_B_SHAPER_FREQUENCY;
+  settings.shaper_frequency[C_AXIS] = DEFAULT_C_SHAPER_FREQUENCY;
+  settings.shaper_frequency[D_AXIS] = DEFAULT_D_SHAPER_FREQUENCY;
+  settings.shaper_frequency[E_AXIS] = DEFAULT_E_SHAPER_FREQUENCY;
+  settings.shaper_frequency[F_AXIS] = DEFAULT_F_SHAPER_FREQUENCY;
+  settings.shaper_frequency[G_AXIS] = DEFAULT_G_SHAPER_FREQUENCY;
+
+  settings.shaper_damping[A_AXIS] = DEFAULT_A_SHAPER_DAMPING;
+  settings.shaper_damping[B_AXIS] = DEFAULT_B_SHAPER_DAMPING;
+  settings.shaper_damping[C_AXIS] = DEFAULT_C_SHAPER_DAMPING;
+  settings.shaper_damping[D_AXIS] = DEFAULT_D_SHAPER_DAMPING;
+  settings.shaper_damping[E_AXIS] = DEFAULT_E_SHAPER_DAMPING;
+  settings.shaper_damping[F_AXIS] = DEFAULT_F_SHAPER_DAMPING;
+  settings.shaper_damping[G_AXIS] = DEFAULT_G_SHAPER_DAMPING;
+
   settings.robot_qinnew.D1 = DEFAULTS_D1;
   settings.robot_qinnew.A1 = DEFAULTS_A1;
   settings.robot_qinnew.A2 = DEFAULTS_A2;
@@ -133,9 +159,8 @@ void settings_restore(uint8_t restore_flag) {
   settings.robot_qinnew.D4 = DEFAULTS_D4;
   settings.robot_qinnew.L  = DEFAULTS_L;
   settings.robot_qinnew.use_interpolation = DEFAULTS_use_interpolation;
-  settings.robot_qinnew.interpolation_num = DEFAULTS_interpolation_num;
-  settings.robot_qinnew.use_compensation = DEFAULTS_use_compensation;
-  settings.robot_qinnew.compensation_num = DEFAULTS_compensation_num;
+  settings.robot_qinnew.path_tolerance = DEFAULTS_path_tolerance;
+  settings.robot_qinnew.tool_acceleration = DEFAULTS_tool_acceleration;
   settings.robot_qinnew.use_reset_pos = DEFAULTS_use_reset_pos;
   settings.robot_qinnew.use_Back_to_text = DEFAULTS_use_Back_to_text;
 
@@ -145,6 +170,7 @@ void settings_restore(uint8_t restore_flag) {
   settings.robot_qinnew.offset[G_AXIS]  = DEFAULTS_offset_z;
 
 	write_global_settings();
+	InverseInit();
   }
   
   if (restore_flag & SETTINGS_RESTORE_PARAMETERS) {
@@ -226,7 +252,10 @@ uint8_t read_global_settings() {
 
 // A helper method to set settings from command line
 uint8_t settings_store_global_setting(uint8_t parameter, float value) {
-  if (value < 0.0) { return(STATUS_NEGATIVE_VALUE); }
+  if (value < 0.0) {
+    // Tool length $45 is stored signed, like DEFAULTS_L. Everything else must be positive.
+    if (parameter != 45) { return(STATUS_NEGATIVE_VALUE); }
+  }
   if (parameter >= AXIS_SETTINGS_START_VAL) {
     // Store axis configuration. Axis numbering sequence set by AXIS_SETTING defines.
     // NOTE: Ensure the setting index corresponds to the report.c settings printout.
@@ -241,6 +270,7 @@ uint8_t settings_store_global_setting(uint8_t parameter, float value) {
               if (value*settings.max_rate[parameter] > (MAX_STEP_RATE_HZ*60.0)) { return(STATUS_MAX_STEP_RATE_EXCEEDED); }
             #endif
             settings.steps_per_mm[parameter] = value;
+            kin.fk_valid = false; // Cached status report pose was solved from the old step scaling.
             break;
           case 1:
             #ifdef MAX_STEP_RATE_HZ
@@ -252,6 +282,13 @@ uint8_t settings_store_global_setting(uint8_t parameter, float value) {
           case 3: settings.max_travel[parameter] = value; break;  // Store as negative for grbl internal use.
 		  case 4: settings.min_travel[parameter] = value; break;
 		  case 5: settings.Reset[parameter] = value;break;
+		  case 6: settings.backlash[parameter] = value; break;
+		  #ifdef INPUT_SHAPING
+		    case 7: settings.shaper_frequency[parameter] = value; st_generate_input_shapers(); break;
+		    case 8:
+		      if (value >= 1.0) { return(STATUS_SETTING_INPUT_SHAPER); }
+		      settings.shaper_damping[parameter] = value; st_generate_input_shapers(); break;
+		  #endif
         }
         break; // Exit while-loop after setting has been configured and proceed to the EEPROM write call.
       } else {
@@ -296,6 +333,14 @@ uint8_t settings_store_global_setting(uint8_t parameter, float value) {
         if (int_value) { settings.flags |= BITFLAG_REPORT_INCHES; }
         else { settings.flags &= ~BITFLAG_REPORT_INCHES; }
         break;
+      #ifdef S_CURVE_ACCELERATION
+        case 14: settings.jerk = value*60*60*60; break; // Convert to mm/min^3 for grbl internal use.
+      #endif
+      #ifdef INPUT_SHAPING
+        case 15:
+          if (int_value > SHAPER_EI) { return(STATUS_SETTING_INPUT_SHAPER); }
+          settings.shaper_type = int_value; st_generate_input_shapers(); break;
+      #endif
       case 20:
         if (int_value) { 
           if (bit_isfalse(settings.flags, BITFLAG_HOMING_ENABLE)) { return(STATUS_SOFT_LIMIT_ERROR); }
@@ -320,6 +365,24 @@ uint8_t settings_store_global_setting(uint8_t parameter, float value) {
       case 26: settings.homing_debounce_delay = int_value; break;
       case 27: settings.homing_pulloff = value; break;
 	  case 28: settings.homing_pos_dir_mask = int_value; break;
+      // Robot geometry. Refresh the cached kinematic constants right away, so the next
+      // Cartesian move is solved with the new link lengths.
+      case 40: settings.robot_qinnew.D1 = value; InverseInit(); break;
+      case 41: settings.robot_qinnew.A1 = value; InverseInit(); break;
+      case 42: 
+        if (value == 0.0) { return(STATUS_INVALID_STATEMENT); }
+        settings.robot_qinnew.A2 = value; InverseInit(); break;
+      case 43: // A3 and D4 may not both be zero, which leaves the forearm without length.
+        if ((value == 0.0) && (settings.robot_qinnew.D4 == 0.0)) { return(STATUS_INVALID_STATEMENT); }
+        settings.robot_qinnew.A3 = value; InverseInit(); break;
+      case 44: 
+        if ((value == 0.0) && (settings.robot_qinnew.A3 == 0.0)) { return(STATUS_INVALID_STATEMENT); }
+        settings.robot_qinnew.D4 = value; InverseInit(); break;
+      case 45: settings.robot_qinnew.L = value; InverseInit(); break;
+      case 46: 
+        if (value == 0.0) { return(STATUS_INVALID_STATEMENT); }
+        settings.robot_qinnew.path_tolerance = value; break;
+      case 47: settings.robot_qinnew.tool_acceleration = value*60*60; break; // Convert to mm/min^2 for grbl internal use.
 
 	  
 	  
@@ -339,6 +402,7 @@ void settings_init() {
     settings_restore(SETTINGS_RESTORE_ALL); // Force restore all EEPROM data.
     report_grbl_settings();
   }
+  InverseInit(); // Compute kinematic constants from the loaded robot geometry.
 
   // NOTE: Checking paramater data, startup lines, and build info string should be done here, 
   // but it seems fairly redundant. Each of these can be manually checked and reset or restored.
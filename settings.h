@@ -45,6 +45,12 @@
 #define BITFLAG_RT_STATUS_PUMP_PWM          bit(5)
 #define BITFLAG_RT_STATUS_Coordinate_MODE   bit(6)
 
+// Define input shaper types of settings.shaper_type
+#define SHAPER_NONE 0
+#define SHAPER_ZV   1 // Zero vibration. Shortest, but sensitive to the resonance being off its setting.
+#define SHAPER_ZVD  2 // Zero vibration and derivative. Twice as long, tolerates a frequency error.
+#define SHAPER_EI   3 // Extra-insensitive. As long as ZVD, tolerates a wider frequency error.
+
 
 // Define settings restore bitflags.
 #define SETTINGS_RESTORE_ALL 0xFF // All bitflags
@@ -71,7 +77,11 @@
 // #define SETTING_INDEX_G92    N_COORDINATE_SYSTEM+2  // Coordinate offset (G92.2,G92.3 not supported)
 
 // Define Grbl axis settings numbering scheme. Starts at START_VAL, every INCREMENT, over N_SETTINGS.
-#define AXIS_N_SETTINGS          6
+#ifdef INPUT_SHAPING
+  #define AXIS_N_SETTINGS        9
+#else
+  #define AXIS_N_SETTINGS        7
+#endif
 #define AXIS_SETTINGS_START_VAL  100 // NOTE: Reserving settings values >= 100 for axis settings. Up to 255.
 #define AXIS_SETTINGS_INCREMENT  10  // Must be greater than the number of axis settings
 
@@ -84,6 +94,9 @@ typedef struct {
   float max_travel[N_AXIS];
   float min_travel[N_AXIS];
   float Reset[N_AXIS];
+  float backlash[N_AXIS];   // Slack taken up when an axis reverses, in mm
+  float shaper_frequency[N_AXIS]; // Resonant frequency the input shaper cancels, in Hz. 0 for none.
+  float shaper_damping[N_AXIS];   // Damping ratio of the resonance, 0 to below 1
 
   // Remaining Grbl settings
   uint8_t pulse_microseconds;
@@ -93,6 +106,8 @@ typedef struct {
   uint8_t status_report_mask; // Mask to indicate desired report data.
   float junction_deviation;
   float arc_tolerance;
+  float jerk;               // S-curve acceleration jerk in mm/min^3, 0 for trapezoid ramps
+  uint8_t shaper_type;      // SHAPER_* input shaper of the axes with a shaper frequency
   
   uint8_t flags;  // Contains default boolean settings
 
@@ -84,128 +84,130 @@ void spindle_stop_2()
 #endif
 
 
-void spindle_run(uint8_t direction, float rpm)
+// Returns the PWM value of a spindle speed on an output of range pwm_max. 0 stops the output.
+static uint16_t spindle_compute_pwm(float rpm, float pwm_max)
 {
-  if (sys.state == STATE_CHECK_MODE) { return; }
-
-  // Empty planner buffer to ensure spindle is set when programmed.
-  protocol_auto_cycle_start();  //temp fix for M3 lockup
-  protocol_buffer_synchronize();
-
-  if (direction == SPINDLE_DISABLE) {
-
-    spindle_stop();
-
-  } else {
-
+  if (rpm <= 0.0) { return(0); } // RPM should never be negative, but check anyway.
 #ifdef VARIABLE_SPINDLE
-		// TODO: Install the optional capability for frequency-based output for servos.
-  #ifdef CPU_MAP_ATMEGA2560
-		  TCCRA_REGISTER = (1<<COMB_BIT) | (1<<WAVE1_REGISTER) | (1<<WAVE0_REGISTER);//TCCR4A:0010 0011
-		  TCCRB_REGISTER = (TCCRB_REGISTER & 0b11111000) | 0x02 | (1<<WAVE2_REGISTER) | (1<<WAVE3_REGISTER); 
-		  // set to 1/8 Prescaler
-		  //TCCR4A:0010 0011
-	  //  TCCR4Bxxx1 1010 
-		  OCR4A = 0xFFFF; 
-		  uint16_t current_pwm;
-  #else
-		  TCCRA_REGISTER = (1<<COMB_BIT) | (1<<WAVE1_REGISTER) | (1<<WAVE0_REGISTER);
-		  TCCRB_REGISTER = (TCCRB_REGISTER & 0b11111000) | 0x02; // set to 1/8 Prescaler
-		  uint8_t current_pwm;
+  #define SPINDLE_RPM_RANGE (SPINDLE_MAX_RPM-SPINDLE_MIN_RPM)
+  if ( rpm < SPINDLE_MIN_RPM ) { rpm = 0; } 
+  else { 
+    rpm -= SPINDLE_MIN_RPM; 
+    if ( rpm > SPINDLE_RPM_RANGE ) { rpm = SPINDLE_RPM_RANGE; } // Prevent integer overflow
+  }
+  uint16_t current_pwm = floor( rpm*(pwm_max/SPINDLE_RPM_RANGE) + 0.5);
+  #ifdef MINIMUM_SPINDLE_PWM
+    if (current_pwm < MINIMUM_SPINDLE_PWM) { current_pwm = MINIMUM_SPINDLE_PWM; }
   #endif
-	  
-		if (rpm <= 0.0) { spindle_stop(); } // RPM should never be negative, but check anyway.
-		else {
-	#define SPINDLE_RPM_RANGE (SPINDLE_MAX_RPM-SPINDLE_MIN_RPM)
-		  if ( rpm < SPINDLE_MIN_RPM ) { rpm = 0; } 
-		  else { 
-			rpm -= SPINDLE_MIN_RPM; 
-			if ( rpm > SPINDLE_RPM_RANGE ) { rpm = SPINDLE_RPM_RANGE; } // Prevent integer overflow
-		  }
-		  current_pwm = floor( rpm*(PWM_MAX_VALUE/SPINDLE_RPM_RANGE) + 0.5);
-	#ifdef MINIMUM_SPINDLE_PWM
-			if (current_pwm < MINIMUM_SPINDLE_PWM) { current_pwm = MINIMUM_SPINDLE_PWM; }
-	#endif
-		  OCR_REGISTER = current_pwm; // Set PWM pin output  OCR4B
-	  
-		  // On the Uno, spindle enable and PWM are shared, unless otherwise specified.
-	#if defined(CPU_MAP_ATMEGA2560) || defined(USE_SPINDLE_DIR_AS_ENABLE_PIN) 
-	  #ifdef INVERT_SPINDLE_ENABLE_PIN
-			  SPINDLE_ENABLE_PORT &= ~(1<<SPINDLE_ENABLE_BIT);
-	  #else
-			  SPINDLE_ENABLE_PORT |= (1<<SPINDLE_ENABLE_BIT);
-	  #endif
-	#endif
-		}
-		
+  return(current_pwm);
 #else
-		// NOTE: Without variable spindle, the enable bit should just turn on or off, regardless
-		// if the spindle speed value is zero, as its ignored anyhow.	   
+  // NOTE: Without variable spindle, the enable bit should just turn on or off, regardless
+  // if the spindle speed value is zero, as its ignored anyhow.	   
+  return(1);
 #endif
-  }
 }
 
 
-void spindle_run_2(uint8_t direction, float rpm)
+// Sets the spindle PWM, or stops the spindle for a zero value. Also called from the stepper ISR.
+static void spindle_set_pwm(uint16_t current_pwm)
 {
-  if (sys.state == STATE_CHECK_MODE) { return; }
-
-  // Empty planner buffer to ensure spindle is set when programmed.
-  protocol_auto_cycle_start();  //temp fix for M3 lockup
-  protocol_buffer_synchronize();
-
-  if (direction == SPINDLE_DISABLE) {
-
-    spindle_stop_2();
-
-  } else {
-
-
+  if (current_pwm == 0) { spindle_stop(); return; }
+#ifdef VARIABLE_SPINDLE
+  #ifdef CPU_MAP_ATMEGA2560
+	  TCCRA_REGISTER = (1<<COMB_BIT) | (1<<WAVE1_REGISTER) | (1<<WAVE0_REGISTER);//TCCR4A:0010 0011
+	  TCCRB_REGISTER = (TCCRB_REGISTER & 0b11111000) | 0x02 | (1<<WAVE2_REGISTER) | (1<<WAVE3_REGISTER); 
+	  // set to 1/8 Prescaler
+	  OCR4A = 0xFFFF; 
+  #else
+	  TCCRA_REGISTER = (1<<COMB_BIT) | (1<<WAVE1_REGISTER) | (1<<WAVE0_REGISTER);
+	  TCCRB_REGISTER = (TCCRB_REGISTER & 0b11111000) | 0x02; // set to 1/8 Prescaler
+  #endif
+  OCR_REGISTER = current_pwm; // Set PWM pin output  OCR4B
 
-      // TODO: Install the optional capability for frequency-based output for servos.
-      #define SPINDLE_RPM_RANGE_2 (SPINDLE_MAX_RPM-SPINDLE_MIN_RPM)
-      #define RC_SERVO_RANGE_2 (RC_SERVO_LONG_2-RC_SERVO_SHORT_2)
+  // On the Uno, spindle enable and PWM are shared, unless otherwise specified.
+  #if defined(CPU_MAP_ATMEGA2560) || defined(USE_SPINDLE_DIR_AS_ENABLE_PIN) 
+    #ifdef INVERT_SPINDLE_ENABLE_PIN
+	  SPINDLE_ENABLE_PORT &= ~(1<<SPINDLE_ENABLE_BIT);
+    #else
+	  SPINDLE_ENABLE_PORT |= (1<<SPINDLE_ENABLE_BIT);
+    #endif
+  #endif
+#endif
+}
 
 
+#ifdef VARIABLE_SPINDLE_2
+// Sets the spindle 2 PWM, or stops it for a zero value. Also called from the stepper ISR.
+static void spindle_set_pwm_2(uint16_t current_pwm)
+{
+  if (current_pwm == 0) { spindle_stop_2(); return; }
 #ifdef VARIABLE_SPINDLE
-	// TODO: Install the optional capability for frequency-based output for servos.
   #ifdef CPU_MAP_ATMEGA2560
 	  TCCRA_REGISTER_2 = (1<<COMB_BIT_2) | (1<<WAVE1_REGISTER_2) | (1<<WAVE0_REGISTER_2);//TCCR4A:0010 0011
 	  TCCRB_REGISTER_2 = (TCCRB_REGISTER_2 & 0b11111000) | 0x02 | (1<<WAVE2_REGISTER_2) | (1<<WAVE3_REGISTER_2); 
 	  // set to 1/8 Prescaler
-	  //TCCR4A:0010 0011
-  //  TCCR4Bxxx1 1010 
 	  OCR3A = 0xFFFF; 
-	  uint16_t current_pwm;
-  
-	if (rpm <= 0.0) { spindle_stop_2(); } // RPM should never be negative, but check anyway.
-	else {
-	#define SPINDLE_RPM_RANGE (SPINDLE_MAX_RPM-SPINDLE_MIN_RPM)
-	  if ( rpm < SPINDLE_MIN_RPM ) { rpm = 0; } 
-	  else { 
-		rpm -= SPINDLE_MIN_RPM; 
-		if ( rpm > SPINDLE_RPM_RANGE ) { rpm = SPINDLE_RPM_RANGE; } // Prevent integer overflow
-	  }
-	  current_pwm = floor( rpm*(PWM_MAX_VALUE_2/SPINDLE_RPM_RANGE) + 0.5);
-	#ifdef MINIMUM_SPINDLE_PWM
-		if (current_pwm < MINIMUM_SPINDLE_PWM) { current_pwm = MINIMUM_SPINDLE_PWM; }
-	#endif
 	  OCR_REGISTER_2 = current_pwm; // Set PWM pin output 
-  
-	  // On the Uno, spindle enable and PWM are shared, unless otherwise specified.
-	}
-	
+  #endif
 #else
-	// NOTE: Without variable spindle, the enable bit should just turn on or off, regardless
-	// if the spindle speed value is zero, as its ignored anyhow.	   
   #ifdef INVERT_SPINDLE_ENABLE_PIN
 	  SPINDLE_ENABLE_PORT &= ~(1<<SPINDLE_ENABLE_BIT);
   #else
 	  SPINDLE_ENABLE_PORT |= (1<<SPINDLE_ENABLE_BIT);
   #endif
 #endif
-    
+}
+#endif
+
+
+void spindle_apply_outputs(uint8_t output_bits, uint16_t *output_pwm)
+{
+  if (output_bits & bit(OUTPUT_PUMP)) { 
+    spindle_set_pwm(output_pwm[OUTPUT_PUMP]); 
+    #ifdef LASER_DYNAMIC_POWER
+      if (output_bits & bit(OUTPUT_LASER_DYNAMIC)) { OCR_REGISTER = 0; } // Step segments set the power.
+    #endif
   }
+  #ifdef VARIABLE_SPINDLE_2
+    if (output_bits & bit(OUTPUT_VALVE)) { spindle_set_pwm_2(output_pwm[OUTPUT_VALVE]); }
+  #endif
+}
+
+
+// Queues an output change behind the motion issued so far instead of draining the planner. It
+// starts with the next planner block, or right away when no motion is left to wait for.
+static void spindle_queue_output(uint8_t output, uint16_t current_pwm)
+{
+  mc_cartesian_flush(); // Any streamed rest of a Cartesian line comes first.
+  plan_queue_output(output, current_pwm);
+  if ((sys.state == STATE_IDLE) && (plan_get_current_block() == NULL)) { plan_flush_outputs(); }
+}
+
+
+void spindle_run(uint8_t direction, float rpm)
+{
+  if (sys.state == STATE_CHECK_MODE) { return; }
+
+  uint16_t current_pwm = 0;
+  if (direction != SPINDLE_DISABLE) { current_pwm = spindle_compute_pwm(rpm, PWM_MAX_VALUE); }
+  #ifdef LASER_DYNAMIC_POWER
+    if ((direction == SPINDLE_ENABLE_CCW) && current_pwm) {
+      spindle_queue_output(OUTPUT_LASER_DYNAMIC, current_pwm);
+      return;
+    }
+  #endif
+  spindle_queue_output(OUTPUT_PUMP, current_pwm);
+}
+
+
+#ifdef VARIABLE_SPINDLE_2
+void spindle_run_2(uint8_t direction, float rpm)
+{
+  if (sys.state == STATE_CHECK_MODE) { return; }
+
+  uint16_t current_pwm = 0;
+  if (direction != SPINDLE_DISABLE) { current_pwm = spindle_compute_pwm(rpm, PWM_MAX_VALUE_2); }
+  spindle_queue_output(OUTPUT_VALVE, current_pwm);
 }
 #endif
 
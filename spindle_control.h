@@ -43,6 +43,10 @@ void spindle_set_state(uint8_t state, float rpm);
 // Kills spindle.
 void spindle_stop();
 
+// Sets the outputs flagged in output_bits, bit(OUTPUT_*), to their output_pwm[] values. Called by
+// the stepper ISR as the block a queued output change precedes starts, see plan_queue_output().
+void spindle_apply_outputs(uint8_t output_bits, uint16_t *output_pwm);
+
 #ifdef VARIABLE_SPINDLE_2
 void spindle_init_2();
 
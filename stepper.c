@@ -29,6 +29,15 @@
 #define RAMP_CRUISE 1
 #define RAMP_DECEL 2
 
+// Ramps of the velocity profile are shaped by st_prep_ramp() with either option enabled.
+#if defined(S_CURVE_ACCELERATION) || defined(INPUT_SHAPING)
+  #define SHAPED_RAMPS
+#endif
+
+// Residual vibration the EI shaper allows at its frequency, as a fraction of the unshaped ringing.
+// Tolerated in exchange for keeping most of the vibration reduction over a wider frequency band.
+#define SHAPER_EI_VIBRATION 0.05
+
 // Define Adaptive Multi-Axis Step-Smoothing(AMASS) levels and cutoff frequencies. The highest level
 // frequency bin starts at 0Hz and ends at its cutoff frequency. The next lower level frequency bin
 // starts at the next higher cutoff frequency, and so on. The cutoff frequencies for each level must
@@ -53,8 +62,15 @@
 // data for its own use. 
 typedef struct {  
   uint8_t direction_bits;
+  int8_t direction_sign[N_AXIS];   // +1 or -1, what each step of the axis adds to sys.position
   uint32_t steps[N_AXIS];
   uint32_t step_event_count;
+  uint16_t backlash_steps[N_AXIS]; // Leading steps of each axis taking up backlash. See plan_buffer_line().
+  uint8_t output_bits;             // Output changes applied as the block starts. See plan_queue_output().
+  uint16_t output_pwm[N_OUTPUT];
+  #ifdef LASER_DYNAMIC_POWER
+    uint8_t laser_dynamic;         // Segments of the block set the laser power. See LASER_DYNAMIC_POWER.
+  #endif
 } st_block_t;
 static st_block_t st_block_buffer[SEGMENT_BUFFER_SIZE-1];
 
@@ -71,19 +87,19 @@ typedef struct {
   #else
     uint8_t prescaler;      // Without AMASS, a prescaler is required to adjust for slow timing.
   #endif
+  #ifdef LASER_DYNAMIC_POWER
+    uint16_t laser_pwm;     // Laser power for the average speed of the segment
+  #endif
 } segment_t;
 static segment_t segment_buffer[SEGMENT_BUFFER_SIZE];
 
 // Stepper ISR data struct. Contains the running data for the main stepper ISR.
 typedef struct {
   // Used by the bresenham line algorithm
-  uint32_t counter_a,        // Counter variables for the bresenham line tracer
-           counter_b, 
-           counter_c,
-           counter_d,
-           counter_e,
-           counter_f,
-           counter_g;
+  uint32_t counter[N_AXIS];  // Counter variables for the bresenham line tracer
+  uint32_t steps[N_AXIS];    // Bresenham increments of the executing segment, AMASS applied
+  uint32_t step_event_count;
+  int16_t position_steps[N_AXIS]; // Signed steps taken since sys.position was last updated
   #ifdef STEP_PULSE_DELAY
     uint8_t step_bits;  // Stores out_bits output to complete the step pulse delay
   #endif
@@ -92,11 +108,9 @@ typedef struct {
   uint8_t step_pulse_time;  // Step pulse reset time after step rise
   uint8_t step_outbits;         // The next stepping-bits to be output
   uint8_t dir_outbits;
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    uint32_t steps[N_AXIS];
-  #endif
 
   uint16_t step_count;       // Steps remaining in line segment motion  
+  uint16_t backlash_steps[N_AXIS]; // Backlash steps left in the executing block. Not machine position.
   uint8_t exec_block_index; // Tracks the current st_block index. Change indicates new block.
   st_block_t *exec_block;   // Pointer to the block data for the segment being executed
   segment_t *exec_segment;  // Pointer to the segment being executed
@@ -112,6 +126,10 @@ static uint8_t segment_next_head;
 static uint8_t step_port_invert_mask;
 static uint8_t dir_port_invert_mask;
 
+// Step pin of each axis, by axis index. Constant, so the ISR indexes it at compile time.
+static const uint8_t step_pin_mask[N_AXIS] = { (1<<A_STEP_BIT_T), (1<<B_STEP_BIT_T), (1<<C_STEP_BIT_T),
+  (1<<D_STEP_BIT_T), (1<<X_STEP_BIT_T), (1<<Y_STEP_BIT_T), (1<<Z_STEP_BIT_T) };
+
 // Used to avoid ISR nesting of the "Stepper Driver Interrupt". Should never occur though.
 static volatile uint8_t busy;   
 
@@ -139,9 +157,45 @@ typedef struct {
   float exit_speed;       // Exit speed of executing block (mm/min)
   float accelerate_until; // Acceleration ramp end measured from end of block (mm)
   float decelerate_after; // Deceleration ramp start measured from end of block (mm)
+
+  #ifdef LASER_DYNAMIC_POWER
+    uint16_t laser_pwm;   // Laser power at the programmed feed rate, 0 if not in dynamic laser mode
+    float laser_scale;    // Laser power per speed of the prepped block (1/(mm/min))
+  #endif
+
+  #ifdef SHAPED_RAMPS
+    uint8_t ramp_shaped;  // Ramps of the current profile run through st_prep_ramp().
+    float ramp_mm;        // Start of the base ramp measured from end of block (mm). See st_prep_ramp().
+    float ramp_end_mm;    // End of the ramp measured from end of block (mm)
+    float ramp_time;      // Time into the ramp (min)
+    float ramp_duration;  // Time of the whole ramp (min)
+    float ramp_base_time; // Time of the base ramp, before input shaping (min)
+    float ramp_jerk_time; // Time of the jerk phase at either end of the base ramp (min)
+    float ramp_accel;     // Peak acceleration of the base ramp, negative when decelerating (mm/min^2)
+    float ramp_speed;     // Speed at the start of the ramp (mm/min)
+    float ramp_end_speed; // Speed at the end of the ramp (mm/min)
+  #endif
+
+  #ifdef INPUT_SHAPING
+    uint8_t shaper_impulses;  // Impulses of the input shaper of the prepped block, 1 if unshaped
+    uint8_t ramp_impulses;    // Impulses shaping the current ramp, 1 if too short to shape
+    float shaper_time[SHAPER_MAX_IMPULSES];      // Impulse delays, in increasing order (min)
+    float shaper_amplitude[SHAPER_MAX_IMPULSES]; // Impulse amplitudes, adding up to 1
+  #endif
 } st_prep_t;
 static st_prep_t prep;
 
+#ifdef INPUT_SHAPING
+// Input shaper of each axis, generated from the $15 shaper type and the $17x frequency and $18x
+// damping of the axis by st_generate_input_shapers().
+typedef struct {
+  uint8_t impulses;     // 0 if the axis is not shaped
+  float time[3];        // Impulse delays (min)
+  float amplitude[3];   // Impulse amplitudes, adding up to 1
+} axis_shaper_t;
+static axis_shaper_t axis_shaper[N_AXIS];
+#endif
+
 
 /*    BLOCK VELOCITY PROFILE DEFINITION 
           __________________________
@@ -279,9 +333,51 @@ void st_go_idle()
    ISR is 5usec typical and 25usec maximum, well below requirement.
    NOTE: This ISR expects at least one step to be executed per segment.
 */
-// TODO: Replace direct updating of the int32 position counters in the ISR somehow. Perhaps use smaller
-// int8 variables and update position counters only when a segment completes. This can get complicated 
-// with probing and homing cycles that require true real-time positions.
+// NOTE: The ISR does not update the int32 sys.position counters per step. It adds the signed step of
+// each axis to a small per-axis count, and st_update_position() moves the counts into sys.position
+// as segments are prepped, when the segment buffer runs empty and on reset. Real-time readers, like
+// status reports and the probe, use st_get_position().
+
+
+// Adds the steps taken by the stepper ISR to sys.position. Each axis is updated with interrupts
+// disabled, to keep the stepper ISR latency short. The counts stay far below the int16 range, since
+// they are cleared at least once per segment buffer worth of steps.
+static void st_update_position()
+{
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) {
+    uint8_t sreg = SREG;
+    cli();
+    sys.position[idx] += st.position_steps[idx];
+    st.position_steps[idx] = 0;
+    SREG = sreg;
+  }
+}
+
+
+// Copies the real-time machine position in steps, including the steps not yet in sys.position.
+void st_get_position(int32_t *position)
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint8_t idx;
+  for (idx=0; idx<N_AXIS; idx++) { position[idx] = sys.position[idx] + st.position_steps[idx]; }
+  SREG = sreg;
+}
+
+
+// Bresenham step of axis idx for the current ISR tick. Always inlined with a constant idx, so the
+// array accesses compile to direct addresses, as the former per-axis code did.
+static inline void __attribute__((always_inline)) st_step_axis(uint8_t idx)
+{
+  st.counter[idx] += st.steps[idx];
+  if (st.counter[idx] > st.step_event_count) {
+    st.step_outbits |= step_pin_mask[idx];
+    st.counter[idx] -= st.step_event_count;
+    if (st.backlash_steps[idx]) { st.backlash_steps[idx]--; } // Slack only. Tool stays put.
+    else { st.position_steps[idx] += st.exec_block->direction_sign[idx]; }
+  }
+}
 
 
 ISR(TIMER1_COMPA_vect)
@@ -336,9 +432,18 @@ ISR(TIMER1_COMPA_vect)
         st.exec_block = &st_block_buffer[st.exec_block_index];
         
         // Initialize Bresenham line and distance counters
-        st.counter_a = st.counter_b = st.counter_c = st.counter_d = st.counter_e = st.counter_f = st.counter_g = (st.exec_block->step_event_count >> 1);
+        st.step_event_count = st.exec_block->step_event_count;
+        st.counter[A_AXIS] = st.counter[B_AXIS] = st.counter[C_AXIS] = st.counter[D_AXIS] = st.counter[E_AXIS] = st.counter[F_AXIS] = st.counter[G_AXIS] = (st.step_event_count >> 1);
+        memcpy(st.backlash_steps, st.exec_block->backlash_steps, sizeof(st.backlash_steps));
+        #ifndef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
+          memcpy(st.steps, st.exec_block->steps, sizeof(st.steps));
+        #endif
+        if (st.exec_block->output_bits) { spindle_apply_outputs(st.exec_block->output_bits, st.exec_block->output_pwm); }
       }
       st.dir_outbits = st.exec_block->direction_bits ^ dir_port_invert_mask; 
+      #ifdef LASER_DYNAMIC_POWER
+        if (st.exec_block->laser_dynamic) { OCR_REGISTER = st.exec_segment->laser_pwm; }
+      #endif
 
       #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
         // With AMASS enabled, adjust Bresenham axis increment counters according to AMASS level.
@@ -354,6 +459,10 @@ ISR(TIMER1_COMPA_vect)
     } else {
       // Segment buffer empty. Shutdown.
       st_go_idle();
+      st_update_position(); // Leave sys.position exact at standstill.
+      #ifdef LASER_DYNAMIC_POWER
+        if ((st.exec_block != NULL) && st.exec_block->laser_dynamic) { OCR_REGISTER = 0; } // Off at standstill.
+      #endif
       bit_true_atomic(sys_rt_exec_state,EXEC_CYCLE_STOP); // Flag main program for cycle end
       return; // Nothing to do but exit.
     }  
@@ -367,95 +476,16 @@ ISR(TIMER1_COMPA_vect)
   st.step_outbits = 0; 
 
   // Execute step displacement profile by Bresenham line algorithm
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_a += st.steps[A_AXIS];
-  #else
-    st.counter_a += st.exec_block->steps[A_AXIS];
-  #endif  
-  if (st.counter_a > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<A_STEP_BIT_T);
-    st.counter_a -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<A_DIR_BIT)) { sys.position[A_AXIS]--; }
-    else { sys.position[A_AXIS]++; }
-  }
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_b += st.steps[B_AXIS];
-  #else
-    st.counter_b += st.exec_block->steps[B_AXIS];
-  #endif    
-  if (st.counter_b > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<B_STEP_BIT_T);
-    st.counter_b -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<B_DIR_BIT)) { sys.position[B_AXIS]--; }
-    else { sys.position[B_AXIS]++; }
-  }
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_c += st.steps[C_AXIS];
-  #else
-    st.counter_c += st.exec_block->steps[C_AXIS];
-  #endif  
-  if (st.counter_c > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<C_STEP_BIT_T);
-    st.counter_c -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<C_DIR_BIT)) { sys.position[C_AXIS]--; }
-    else { sys.position[C_AXIS]++; }
-  }  
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_d += st.steps[D_AXIS];
-  #else
-    st.counter_d += st.exec_block->steps[D_AXIS];
-  #endif  
-  if (st.counter_d > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<D_STEP_BIT_T);
-    st.counter_d -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<D_DIR_BIT)) { sys.position[D_AXIS]--; }
-    else { sys.position[D_AXIS]++; }
-  } 
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_e += st.steps[E_AXIS];
-  #else
-    st.counter_e += st.exec_block->steps[E_AXIS];
-  #endif  
-  if (st.counter_e > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<X_STEP_BIT_T);
-    st.counter_e -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<X_DIR_BIT)) { sys.position[E_AXIS]--; }
-    else { sys.position[E_AXIS]++; }
-  } 
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_f += st.steps[F_AXIS];
-  #else
-    st.counter_f += st.exec_block->steps[F_AXIS];
-  #endif  
-  if (st.counter_f > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<Y_STEP_BIT_T);
-    st.counter_f -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<Y_DIR_BIT)) { sys.position[F_AXIS]--; }
-    else { sys.position[F_AXIS]++; }
-  } 
-  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
-    st.counter_g += st.steps[G_AXIS];
-  #else
-    st.counter_g += st.exec_block->steps[G_AXIS];
-  #endif  
-  if (st.counter_g > st.exec_block->step_event_count) {
-    st.step_outbits |= (1<<Z_STEP_BIT_T);
-    st.counter_g -= st.exec_block->step_event_count;
-    if (st.exec_block->direction_bits & (1<<Z_DIR_BIT)) { sys.position[G_AXIS]--; }
-    else { sys.position[G_AXIS]++; }
-  } 
+  st_step_axis(A_AXIS);
+  st_step_axis(B_AXIS);
+  st_step_axis(C_AXIS);
+  st_step_axis(D_AXIS);
+  st_step_axis(E_AXIS);
+  st_step_axis(F_AXIS);
+  st_step_axis(G_AXIS);
   // During a homing cycle, lock out and prevent desired axes from moving.
   if (sys.state == STATE_HOMING) { st.step_outbits &= sys.homing_axis_lock; }   
 
-  if ((sys.state != STATE_HOMING)&&(sys.calibration != 1)&&(bit_istrue(settings.flags,BITFLAG_HARD_LIMIT_ENABLE))) {
-	sys.hard_limit_trigger_flag = limits_get_state_hardlimits();
-	if (sys.hard_limit_trigger_flag) {
-  			  print_uint8_base2(sys.hard_limit_trigger_flag);
-			  mc_reset(); // Initiate system kill.
-			  bit_true_atomic(sys_rt_exec_alarm, (EXEC_ALARM_HARD_LIMIT|EXEC_CRITICAL_EVENT)); // Indicate hard limit critical event
-			}
-  	}
-
 
   st.step_count--; // Decrement step events count 
   if (st.step_count == 0) {
@@ -519,11 +549,56 @@ void st_generate_step_dir_invert_masks()
 }
 
 
+#ifdef INPUT_SHAPING
+// Generates the input shaper of each axis from the shaper settings. All three shaper types place
+// their impulses at 0, one half and one damped period of the resonance of the axis. Called by
+// st_reset() and whenever a shaper setting changes.
+void st_generate_input_shapers()
+{
+  uint8_t idx, i;
+  for (idx=0; idx<N_AXIS; idx++) {
+    axis_shaper_t *shaper = &axis_shaper[idx];
+    shaper->impulses = 0;
+    if ((settings.shaper_type == SHAPER_NONE) || (settings.shaper_frequency[idx] <= 0.0)) { continue; }
+    float damping = settings.shaper_damping[idx];
+    float damped = sqrt(1.0 - damping*damping);
+    float k = exp(-damping*M_PI/damped); // Decay of the ringing over half a period
+    float period = 1.0/(60.0*settings.shaper_frequency[idx]*damped); // (min)
+    switch (settings.shaper_type) {
+      case SHAPER_ZV:
+        shaper->impulses = 2;
+        shaper->amplitude[0] = 1.0;
+        shaper->amplitude[1] = k;
+        break;
+      case SHAPER_ZVD:
+        shaper->impulses = 3;
+        shaper->amplitude[0] = 1.0;
+        shaper->amplitude[1] = 2.0*k;
+        shaper->amplitude[2] = k*k;
+        break;
+      default: // case SHAPER_EI:
+        shaper->impulses = 3;
+        shaper->amplitude[0] = 0.25*(1.0+SHAPER_EI_VIBRATION);
+        shaper->amplitude[1] = 0.5*(1.0-SHAPER_EI_VIBRATION)*k;
+        shaper->amplitude[2] = 0.25*(1.0+SHAPER_EI_VIBRATION)*k*k;
+    }
+    float sum = 0.0;
+    for (i=0; i<shaper->impulses; i++) { sum += shaper->amplitude[i]; }
+    for (i=0; i<shaper->impulses; i++) {
+      shaper->amplitude[i] /= sum;
+      shaper->time[i] = 0.5*period*i;
+    }
+  }
+}
+#endif
+
+
 // Reset and clear stepper subsystem variables
 void st_reset()
 {
   // Initialize stepper driver idle state.
   st_go_idle();
+  st_update_position(); // Keep the steps of a segment cut short.
   
   // Initialize stepper algorithm variables.
   memset(&prep, 0, sizeof(st_prep_t));
@@ -536,6 +611,9 @@ void st_reset()
   busy = false;
   
   st_generate_step_dir_invert_masks();
+  #ifdef INPUT_SHAPING
+    st_generate_input_shapers();
+  #endif
       
   // Initialize step and direction port pins.
   //STEP_PORT = (STEP_PORT & ~STEP_MASK) | step_port_invert_mask;
@@ -578,6 +656,19 @@ void stepper_init()
 }
   
 
+#ifdef LASER_DYNAMIC_POWER
+// Tracks the dynamic laser power of the motion being prepped. Called as st_prep_buffer() loads a block,
+// and by plan_flush_outputs() for output changes applied without motion.
+void st_update_laser_power(uint8_t output_bits, uint16_t *output_pwm)
+{
+  if (output_bits & bit(OUTPUT_PUMP)) {
+    if (output_bits & bit(OUTPUT_LASER_DYNAMIC)) { prep.laser_pwm = output_pwm[OUTPUT_PUMP]; }
+    else { prep.laser_pwm = 0; }
+  }
+}
+#endif
+
+
 // Called by planner_recalculate() when the executing block is updated by the new plan.
 void st_update_plan_block_parameters()
 { 
@@ -589,6 +680,224 @@ void st_update_plan_block_parameters()
 }
 
 
+#ifdef INPUT_SHAPING
+// Builds the input shaper of the prepped block by convolving the shapers of its moving axes, in
+// order of their steps. Axes with the same resonance share a shaper. A shaper that would take the
+// impulses past SHAPER_MAX_IMPULSES is left out.
+static void st_prep_block_shaper()
+{
+  uint8_t idx, i, j;
+  uint8_t axis_done = 0;
+  prep.shaper_impulses = 1;
+  prep.shaper_time[0] = 0.0;
+  prep.shaper_amplitude[0] = 1.0;
+  for (;;) {
+    uint8_t axis = N_AXIS;
+    for (idx=0; idx<N_AXIS; idx++) {
+      if ((axis_done & bit(idx)) || !axis_shaper[idx].impulses || !pl_block->steps[idx]) { continue; }
+      if ((axis == N_AXIS) || (pl_block->steps[idx] > pl_block->steps[axis])) { axis = idx; }
+    }
+    if (axis == N_AXIS) { return; }
+    
+    for (idx=0; idx<N_AXIS; idx++) {
+      if ((axis_done & bit(idx)) && (settings.shaper_frequency[idx] == settings.shaper_frequency[axis]) &&
+          (settings.shaper_damping[idx] == settings.shaper_damping[axis])) { break; }
+    }
+    axis_done |= bit(axis);
+    axis_shaper_t *shaper = &axis_shaper[axis];
+    if ((idx < N_AXIS) || (prep.shaper_impulses*shaper->impulses > SHAPER_MAX_IMPULSES)) { continue; }
+
+    // Convolve in place, from the last impulse back, so that each is read before it is overwritten.
+    i = prep.shaper_impulses;
+    while (i--) {
+      float time = prep.shaper_time[i];
+      float amplitude = prep.shaper_amplitude[i];
+      for (j=0; j<shaper->impulses; j++) {
+        prep.shaper_time[i*shaper->impulses+j] = time + shaper->time[j];
+        prep.shaper_amplitude[i*shaper->impulses+j] = amplitude*shaper->amplitude[j];
+      }
+    }
+    prep.shaper_impulses *= shaper->impulses;
+  }
+}
+#endif
+
+
+#ifdef SHAPED_RAMPS
+// Time of the jerk phase at either end of a base ramp taking the given time for the speed change.
+// Zero without S-curve acceleration, for a constant acceleration base ramp.
+static float st_ramp_jerk_time(float duration, float speed_change)
+{
+  #ifdef S_CURVE_ACCELERATION
+    if (settings.jerk > 0.0) {
+      float jerk_time = duration*duration - 4.0*speed_change/settings.jerk;
+      if (jerk_time > 0.0) { return(0.5*(duration - sqrt(jerk_time))); }
+      return(0.5*duration);
+    }
+  #endif
+  return(0.0);
+}
+
+
+/* Starts a ramp from speed_start to speed_end, mm_start from the end of the prepped block. The
+   ramp covers the distance of the planner's constant acceleration ramp, so the block entry and
+   exit speeds and the ramp junctions of the planned profile all still hold.
+     With S-curve acceleration, the base ramp rises and falls at the $14 jerk over a jerk phase at
+   either end and holds a peak acceleration in between. It takes the planner's ramp time, so the
+   peak lies from 1x the planner acceleration for a high jerk up to 2x for a low jerk or a short
+   ramp, where the two jerk phases meet in the middle.
+     With input shaping, the base ramp is convolved with the impulses of the block's shaper, which
+   cancels the residual vibration of the resonances the shaper is tuned to. Shaping draws the ramp
+   out by the shaper time, so the base ramp is cut short by about as much to keep its distance. A
+   ramp too short for that without the base ramp going over 2x the planner acceleration runs
+   unshaped. The base ramp starts ahead of the shaped ramp by the mean impulse delay, which
+   ramp_mm accounts for. */
+static void st_prep_ramp(float speed_start, float speed_end, float mm_start)
+{
+  float speed_change = speed_end - speed_start;
+  float duration = fabs(speed_change)/pl_block->acceleration;
+  float base_time = duration;
+  float jerk_time = st_ramp_jerk_time(duration, fabs(speed_change));
+  prep.ramp_mm = mm_start;
+  prep.ramp_duration = duration;
+  #ifdef INPUT_SHAPING
+    prep.ramp_impulses = 1;
+    if ((prep.shaper_impulses > 1) && (duration > 0.0)) {
+      uint8_t i;
+      float shaper_time = prep.shaper_time[prep.shaper_impulses-1];
+      float mean_delay = 0.0;
+      for (i=1; i<prep.shaper_impulses; i++) { mean_delay += prep.shaper_amplitude[i]*prep.shaper_time[i]; }
+      float shaped_base_time = duration - 2.0*(speed_end*shaper_time - speed_change*mean_delay)/(speed_start+speed_end);
+      if (shaped_base_time > 0.0) {
+        float shaped_jerk_time = st_ramp_jerk_time(shaped_base_time, fabs(speed_change));
+        if (fabs(speed_change) <= 2.0*pl_block->acceleration*(shaped_base_time-shaped_jerk_time)) {
+          prep.ramp_impulses = prep.shaper_impulses;
+          base_time = shaped_base_time;
+          jerk_time = shaped_jerk_time;
+          prep.ramp_mm -= speed_start*mean_delay;
+          prep.ramp_duration = base_time + shaper_time;
+        }
+      }
+    }
+  #endif
+  
+  prep.ramp_end_mm = mm_start - 0.5*(speed_start + speed_end)*duration;
+  prep.ramp_time = 0.0;
+  prep.ramp_base_time = base_time;
+  prep.ramp_jerk_time = jerk_time;
+  if (base_time > 0.0) { prep.ramp_accel = speed_change/(base_time - jerk_time); }
+  else { prep.ramp_accel = 0.0; }
+  prep.ramp_speed = speed_start;
+  prep.ramp_end_speed = speed_end;
+}
+
+
+// Speed reached and distance covered t into the base ramp. Runs on at the start and end speeds
+// before and after it, as the impulses of the shaper delay it.
+static float st_ramp_base(float t, float *speed)
+{
+  if (t <= 0.0) {
+    *speed = prep.ramp_speed;
+    return(t*prep.ramp_speed);
+  }
+  float t_end = prep.ramp_base_time - t;
+  float mm_end = 0.5*(prep.ramp_speed + prep.ramp_end_speed)*prep.ramp_base_time;
+  if (t_end <= 0.0) {
+    *speed = prep.ramp_end_speed;
+    return(mm_end - t_end*prep.ramp_end_speed);
+  }
+  float tj = prep.ramp_jerk_time;
+  float accel = prep.ramp_accel;
+  if (t < tj) { // Jerk phase at the start of the ramp
+    *speed = prep.ramp_speed + accel*t*t/(2.0*tj);
+    return(t*(prep.ramp_speed + accel*t*t/(6.0*tj)));
+  }
+  if (t_end > tj) { // Constant acceleration
+    *speed = prep.ramp_speed + accel*(t - 0.5*tj);
+    return(t*prep.ramp_speed + accel*(0.5*t*(t - tj) + tj*tj/6.0));
+  }
+  // Jerk phase at the end of the ramp, measured back from its end.
+  *speed = prep.ramp_end_speed - accel*t_end*t_end/(2.0*tj);
+  return(mm_end - t_end*(prep.ramp_end_speed - accel*t_end*t_end/(6.0*tj)));
+}
+
+
+// Advances the ramp by time_var and sets mm_remaining and the current speed to where it got.
+// Returns false at the end of the ramp, with time_var cut to the time left to it and mm_remaining
+// set to mm_end, the ramp end of the planned profile.
+static uint8_t st_prep_ramp_step(float *time_var, float *mm_remaining, float mm_end)
+{
+  float t = prep.ramp_time + *time_var;
+  if (t < prep.ramp_duration) {
+    float speed;
+    float mm = st_ramp_base(t, &speed);
+    #ifdef INPUT_SHAPING
+      if (prep.ramp_impulses > 1) { // Convolve the base ramp with the impulses of the shaper.
+        uint8_t i;
+        float impulse_speed;
+        mm *= prep.shaper_amplitude[0];
+        speed *= prep.shaper_amplitude[0];
+        for (i=1; i<prep.ramp_impulses; i++) {
+          mm += prep.shaper_amplitude[i]*st_ramp_base(t - prep.shaper_time[i], &impulse_speed);
+          speed += prep.shaper_amplitude[i]*impulse_speed;
+        }
+      }
+    #endif
+    mm = prep.ramp_mm - mm;
+    if (mm > mm_end) {
+      prep.ramp_time = t;
+      prep.current_speed = speed;
+      *mm_remaining = mm;
+      return(true);
+    }
+  }
+  *time_var = prep.ramp_duration - prep.ramp_time;
+  if (*time_var < 0.0) { *time_var = 0.0; }
+  prep.ramp_time = prep.ramp_duration;
+  prep.current_speed = prep.ramp_end_speed;
+  *mm_remaining = mm_end;
+  return(false);
+}
+#endif
+
+
+// Sets the step timing of a prepped segment from its CPU cycles per step, and with AMASS, its
+// smoothing level and the ISR ticks of its steps.
+static void st_prep_segment_rate(segment_t *prep_segment, uint32_t cycles)
+{
+  #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING        
+    // Compute step timing and multi-axis smoothing level.
+    // NOTE: AMASS overdrives the timer with each level, so only one prescalar is required.
+    if (cycles < AMASS_LEVEL1) { prep_segment->amass_level = 0; }
+    else {
+      if (cycles < AMASS_LEVEL2) { prep_segment->amass_level = 1; }
+      else if (cycles < AMASS_LEVEL3) { prep_segment->amass_level = 2; }
+      else { prep_segment->amass_level = 3; }    
+      cycles >>= prep_segment->amass_level; 
+      prep_segment->n_step <<= prep_segment->amass_level;
+    }
+    if (cycles < (1UL << 16)) { prep_segment->cycles_per_tick = cycles; } // < 65536 (4.1ms @ 16MHz)
+    else { prep_segment->cycles_per_tick = 0xffff; } // Just set the slowest speed possible.
+  #else 
+    // Compute step timing and timer prescalar for normal step generation.
+    if (cycles < (1UL << 16)) { // < 65536  (4.1ms @ 16MHz)
+      prep_segment->prescaler = 1; // prescaler: 0
+      prep_segment->cycles_per_tick = cycles;
+    } else if (cycles < (1UL << 19)) { // < 524288 (32.8ms@16MHz)
+      prep_segment->prescaler = 2; // prescaler: 8
+      prep_segment->cycles_per_tick = cycles >> 3;
+    } else { 
+      prep_segment->prescaler = 3; // prescaler: 64
+      if (cycles < (1UL << 22)) { // < 4194304 (262ms@16MHz)
+        prep_segment->cycles_per_tick =  cycles >> 6;
+      } else { // Just set the slowest speed possible. (Around 4 step/sec.)
+        prep_segment->cycles_per_tick = 0xffff;
+      }
+    }
+  #endif
+}
+
+
 /* Prepares step segment buffer. Continuously called from main program. 
 
    The segment buffer is an intermediary buffer interface between the execution of steps
@@ -620,8 +929,14 @@ void st_prep_buffer()
                       
       // Check if the segment buffer completed the last planner block. If so, load the Bresenham
       // data for the block. If not, we are still mid-block and the velocity profile was updated. 
+      #ifdef SHAPED_RAMPS
+        uint8_t ramp_replanned = false;
+      #endif
       if (prep.flag_partial_block) {
         prep.flag_partial_block = false; // Reset flag
+        #ifdef SHAPED_RAMPS
+          ramp_replanned = (prep.ramp_shaped && prep.ramp_type == RAMP_ACCEL);
+        #endif
       } else {
         // Increment stepper common data index to store new planner block data. 
         if ( ++prep.st_block_index == (SEGMENT_BUFFER_SIZE-1) ) { prep.st_block_index = 0; }
@@ -631,6 +946,20 @@ void st_prep_buffer()
         // segment buffer finishes the prepped block, but the stepper ISR is still executing it. 
         st_prep_block = &st_block_buffer[prep.st_block_index];
         st_prep_block->direction_bits = pl_block->direction_bits;
+        uint8_t idx;
+        for (idx=0; idx<N_AXIS; idx++) {
+          if (pl_block->direction_bits & get_direction_pin_mask(idx)) { st_prep_block->direction_sign[idx] = -1; }
+          else { st_prep_block->direction_sign[idx] = 1; }
+          if (pl_block->backlash_bits & bit(idx)) { st_prep_block->backlash_steps[idx] = plan_backlash_steps(idx); }
+          else { st_prep_block->backlash_steps[idx] = 0; }
+        }
+        st_prep_block->output_bits = pl_block->output_bits;
+        memcpy(st_prep_block->output_pwm, pl_block->output_pwm, sizeof(pl_block->output_pwm));
+        #ifdef LASER_DYNAMIC_POWER
+          st_update_laser_power(pl_block->output_bits, pl_block->output_pwm);
+          st_prep_block->laser_dynamic = (prep.laser_pwm != 0);
+          prep.laser_scale = prep.laser_pwm/sqrt(pl_block->nominal_speed_sqr);
+        #endif
         #ifndef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING
           st_prep_block->steps[A_AXIS] = pl_block->steps[A_AXIS];
           st_prep_block->steps[B_AXIS] = pl_block->steps[B_AXIS];
@@ -644,16 +973,20 @@ void st_prep_buffer()
           // With AMASS enabled, simply bit-shift multiply all Bresenham data by the max AMASS 
           // level, such that we never divide beyond the original data anywhere in the algorithm.
           // If the original data is divided, we can lose a step from integer roundoff.
-          st_prep_block->steps[A_AXIS] = pl_block->steps[A_AXIS] << MAX_AMASS_LEVEL;
-          st_prep_block->steps[B_AXIS] = pl_block->steps[B_AXIS] << MAX_AMASS_LEVEL;
-          st_prep_block->steps[C_AXIS] = pl_block->steps[C_AXIS] << MAX_AMASS_LEVEL;
-          st_prep_block->steps[D_AXIS] = pl_block->steps[D_AXIS] << MAX_AMASS_LEVEL;
-          st_prep_block->steps[E_AXIS] = pl_block->steps[E_AXIS] << MAX_AMASS_LEVEL;
-          st_prep_block->steps[F_AXIS] = pl_block->steps[F_AXIS] << MAX_AMASS_LEVEL;
-          st_prep_block->steps[G_AXIS] = pl_block->steps[G_AXIS] << MAX_AMASS_LEVEL;
-          st_prep_block->step_event_count = pl_block->step_event_count << MAX_AMASS_LEVEL;
+          st_prep_block->steps[A_AXIS] = (uint32_t)pl_block->steps[A_AXIS] << MAX_AMASS_LEVEL;
+          st_prep_block->steps[B_AXIS] = (uint32_t)pl_block->steps[B_AXIS] << MAX_AMASS_LEVEL;
+          st_prep_block->steps[C_AXIS] = (uint32_t)pl_block->steps[C_AXIS] << MAX_AMASS_LEVEL;
+          st_prep_block->steps[D_AXIS] = (uint32_t)pl_block->steps[D_AXIS] << MAX_AMASS_LEVEL;
+          st_prep_block->steps[E_AXIS] = (uint32_t)pl_block->steps[E_AXIS] << MAX_AMASS_LEVEL;
+          st_prep_block->steps[F_AXIS] = (uint32_t)pl_block->steps[F_AXIS] << MAX_AMASS_LEVEL;
+          st_prep_block->steps[G_AXIS] = (uint32_t)pl_block->steps[G_AXIS] << MAX_AMASS_LEVEL;
+          st_prep_block->step_event_count = (uint32_t)pl_block->step_event_count << MAX_AMASS_LEVEL;
         #endif
         
+        #ifdef INPUT_SHAPING
+          st_prep_block_shaper();
+        #endif
+
         // Initialize segment buffer data for generating the segments.
         prep.steps_remaining = pl_block->step_event_count;
         prep.step_per_mm = prep.steps_remaining/pl_block->millimeters;
@@ -670,74 +1003,125 @@ void st_prep_buffer()
         else { prep.current_speed = sqrt(pl_block->entry_speed_sqr); }
       }
      
-      /* --------------------------------------------------------------------------------- 
-         Compute the velocity profile of a new planner block based on its entry and exit
-         speeds, or recompute the profile of a partially-completed planner block if the 
-         planner has updated it. For a commanded forced-deceleration, such as from a feed 
-         hold, override the planner velocities and decelerate to the target exit speed.
-      */
-      prep.mm_complete = 0.0; // Default velocity profile complete at 0.0mm from end of block.
-      float inv_2_accel = 0.5/pl_block->acceleration;
-      if (sys.state & (STATE_HOLD|STATE_MOTION_CANCEL|STATE_SAFETY_DOOR)) { // [Forced Deceleration to Zero Velocity]
-        // Compute velocity profile parameters for a feed hold in-progress. This profile overrides
-        // the planner block profile, enforcing a deceleration to zero speed.
-
-
-		prep.ramp_type = RAMP_DECEL;
-        // Compute decelerate distance relative to end of block.
-        float decel_dist = pl_block->millimeters - inv_2_accel*pl_block->entry_speed_sqr;
-        if (decel_dist < 0.0) {
-          // Deceleration through entire planner block. End of feed hold is not in this block.
-          prep.exit_speed = sqrt(pl_block->entry_speed_sqr-2*pl_block->acceleration*pl_block->millimeters);
-        } else {
-          prep.mm_complete = decel_dist; // End of feed hold.
-          prep.exit_speed = 0.0;
+      if (pl_block->step_event_count == 0) { 
+        prep.current_speed = 0.0; // Dwell block. No velocity profile, only time. See below.
+      } else {
+        /* --------------------------------------------------------------------------------- 
+           Compute the velocity profile of a new planner block based on its entry and exit
+           speeds, or recompute the profile of a partially-completed planner block if the 
+           planner has updated it. For a commanded forced-deceleration, such as from a feed 
+           hold, override the planner velocities and decelerate to the target exit speed.
+        */
+        prep.mm_complete = 0.0; // Default velocity profile complete at 0.0mm from end of block.
+        float inv_2_accel = 0.5/pl_block->acceleration;
+        if (sys.state & (STATE_HOLD|STATE_MOTION_CANCEL|STATE_SAFETY_DOOR)) { // [Forced Deceleration to Zero Velocity]
+          // Compute velocity profile parameters for a feed hold in-progress. This profile overrides
+          // the planner block profile, enforcing a deceleration to zero speed.
+
+
+  		prep.ramp_type = RAMP_DECEL;
+          // Compute decelerate distance relative to end of block.
+          float decel_dist = pl_block->millimeters - inv_2_accel*pl_block->entry_speed_sqr;
+          if (decel_dist < 0.0) {
+            // Deceleration through entire planner block. End of feed hold is not in this block.
+            prep.exit_speed = sqrt(pl_block->entry_speed_sqr-2*pl_block->acceleration*pl_block->millimeters);
+          } else {
+            prep.mm_complete = decel_dist; // End of feed hold.
+            prep.exit_speed = 0.0;
+          }
+        } else { // [Normal Operation]
+          // Compute or recompute velocity profile parameters of the prepped planner block.
+          prep.ramp_type = RAMP_ACCEL; // Initialize as acceleration ramp.
+          prep.accelerate_until = pl_block->millimeters; 
+          prep.exit_speed = plan_get_exec_block_exit_speed();   
+          float exit_speed_sqr = prep.exit_speed*prep.exit_speed;
+          float intersect_distance =
+                  0.5*(pl_block->millimeters+inv_2_accel*(pl_block->entry_speed_sqr-exit_speed_sqr));
+          if (intersect_distance > 0.0) {
+            if (intersect_distance < pl_block->millimeters) { // Either trapezoid or triangle types
+              // NOTE: For acceleration-cruise and cruise-only types, following calculation will be 0.0.
+              prep.decelerate_after = inv_2_accel*(pl_block->nominal_speed_sqr-exit_speed_sqr);
+              if (prep.decelerate_after < intersect_distance) { // Trapezoid type
+                prep.maximum_speed = sqrt(pl_block->nominal_speed_sqr);
+                if (pl_block->entry_speed_sqr == pl_block->nominal_speed_sqr) { 
+                  // Cruise-deceleration or cruise-only type.
+                  prep.ramp_type = RAMP_CRUISE;
+                } else {
+                  // Full-trapezoid or acceleration-cruise types
+                  prep.accelerate_until -= inv_2_accel*(pl_block->nominal_speed_sqr-pl_block->entry_speed_sqr); 
+                }
+              } else { // Triangle type
+                prep.accelerate_until = intersect_distance;
+                prep.decelerate_after = intersect_distance;
+                prep.maximum_speed = sqrt(2.0*pl_block->acceleration*intersect_distance+exit_speed_sqr);
+              }          
+            } else { // Deceleration-only type
+              prep.ramp_type = RAMP_DECEL;
+              // prep.decelerate_after = pl_block->millimeters;
+              prep.maximum_speed = prep.current_speed;
+            }
+          } else { // Acceleration-only type
+            prep.accelerate_until = 0.0;
+            prep.decelerate_after = 0.0;
+            prep.maximum_speed = prep.exit_speed;
+          }
         }
-      } else { // [Normal Operation]
-        // Compute or recompute velocity profile parameters of the prepped planner block.
-        prep.ramp_type = RAMP_ACCEL; // Initialize as acceleration ramp.
-        prep.accelerate_until = pl_block->millimeters; 
-        prep.exit_speed = plan_get_exec_block_exit_speed();   
-        float exit_speed_sqr = prep.exit_speed*prep.exit_speed;
-        float intersect_distance =
-                0.5*(pl_block->millimeters+inv_2_accel*(pl_block->entry_speed_sqr-exit_speed_sqr));
-        if (intersect_distance > 0.0) {
-          if (intersect_distance < pl_block->millimeters) { // Either trapezoid or triangle types
-            // NOTE: For acceleration-cruise and cruise-only types, following calculation will be 0.0.
-            prep.decelerate_after = inv_2_accel*(pl_block->nominal_speed_sqr-exit_speed_sqr);
-            if (prep.decelerate_after < intersect_distance) { // Trapezoid type
-              prep.maximum_speed = sqrt(pl_block->nominal_speed_sqr);
-              if (pl_block->entry_speed_sqr == pl_block->nominal_speed_sqr) { 
-                // Cruise-deceleration or cruise-only type.
-                prep.ramp_type = RAMP_CRUISE;
+
+        #ifdef SHAPED_RAMPS
+          // Start the first ramp of the profile as a shaped ramp. When a replan leaves the block
+          // accelerating to the same speed and the ramp in progress still ends ahead of the
+          // deceleration, keep it running rather than drop the acceleration back to zero.
+          prep.ramp_shaped = false;
+          #ifdef S_CURVE_ACCELERATION
+            if (settings.jerk > 0.0) { prep.ramp_shaped = true; }
+          #endif
+          #ifdef INPUT_SHAPING
+            if (prep.shaper_impulses > 1) { prep.ramp_shaped = true; }
+          #endif
+          if (prep.ramp_shaped) {
+            if (prep.ramp_type == RAMP_DECEL) {
+              st_prep_ramp(prep.current_speed, prep.exit_speed, pl_block->millimeters);
+            } else if (prep.ramp_type == RAMP_ACCEL) {
+              if (ramp_replanned && prep.ramp_end_speed == prep.maximum_speed &&
+                  prep.ramp_end_mm >= prep.decelerate_after) {
+                prep.accelerate_until = prep.ramp_end_mm;
               } else {
-                // Full-trapezoid or acceleration-cruise types
-                prep.accelerate_until -= inv_2_accel*(pl_block->nominal_speed_sqr-pl_block->entry_speed_sqr); 
+                st_prep_ramp(prep.current_speed, prep.maximum_speed, pl_block->millimeters);
               }
-            } else { // Triangle type
-              prep.accelerate_until = intersect_distance;
-              prep.decelerate_after = intersect_distance;
-              prep.maximum_speed = sqrt(2.0*pl_block->acceleration*intersect_distance+exit_speed_sqr);
-            }          
-          } else { // Deceleration-only type
-            prep.ramp_type = RAMP_DECEL;
-            // prep.decelerate_after = pl_block->millimeters;
-            prep.maximum_speed = prep.current_speed;
+            }
           }
-        } else { // Acceleration-only type
-          prep.accelerate_until = 0.0;
-          // prep.decelerate_after = 0.0;
-          prep.maximum_speed = prep.exit_speed;
-        }
-      }  
+        #endif
+      }
     }
 
+    // Move the steps of the segments executed since the last call into sys.position.
+    st_update_position();
+
     // Initialize new segment
     segment_t *prep_segment = &segment_buffer[segment_buffer_head];
 
     // Set new segment to point to the current segment data block.
     prep_segment->st_block_index = prep.st_block_index;
 
+    if (pl_block->step_event_count == 0) {
+      // Dwell block. Segments of up to DT_SEGMENT of ISR ticks without steps time it.
+      float dt = pl_block->millimeters; // Dwell time left (min)
+      if (dt > DT_SEGMENT) { dt = DT_SEGMENT; }
+      prep_segment->n_step = 1;
+      #ifdef LASER_DYNAMIC_POWER
+        prep_segment->laser_pwm = 0; // Off at standstill.
+      #endif
+      st_prep_segment_rate(prep_segment, ceil((TICKS_PER_MICROSECOND*1000000*60)*dt));
+      segment_buffer_head = segment_next_head;
+      if ( ++segment_next_head == SEGMENT_BUFFER_SIZE ) { segment_next_head = 0; }
+      pl_block->millimeters -= dt;
+      if (pl_block->millimeters <= 0.0) {
+        pl_block = NULL; // Dwell complete in the segment buffer.
+        plan_discard_current_block();
+      }
+      continue;
+    }
+
     /*------------------------------------------------------------------------------------
         Compute the average velocity of this new segment by determining the total distance
       traveled over the segment time DT_SEGMENT. The following code first attempts to create 
@@ -764,6 +1148,17 @@ void st_prep_buffer()
     do {
       switch (prep.ramp_type) {
         case RAMP_ACCEL: 
+          #ifdef SHAPED_RAMPS
+            if (prep.ramp_shaped) {
+              if (st_prep_ramp_step(&time_var, &mm_remaining, prep.accelerate_until)) { break; }
+              // End of acceleration ramp. Start the deceleration ramp of a triangle profile.
+              if (mm_remaining == prep.decelerate_after) { 
+                prep.ramp_type = RAMP_DECEL;
+                st_prep_ramp(prep.maximum_speed, prep.exit_speed, mm_remaining);
+              } else { prep.ramp_type = RAMP_CRUISE; }
+              break;
+            }
+          #endif
           // NOTE: Acceleration ramp only computes during first do-while loop.
           speed_var = pl_block->acceleration*time_var;
           mm_remaining -= time_var*(prep.current_speed + 0.5*speed_var);
@@ -788,11 +1183,20 @@ void st_prep_buffer()
             time_var = (mm_remaining - prep.decelerate_after)/prep.maximum_speed;
             mm_remaining = prep.decelerate_after; // NOTE: 0.0 at EOB
             prep.ramp_type = RAMP_DECEL;
+            #ifdef SHAPED_RAMPS
+              if (prep.ramp_shaped) { st_prep_ramp(prep.maximum_speed, prep.exit_speed, mm_remaining); }
+            #endif
           } else { // Cruising only.         
             mm_remaining = mm_var; 
           } 
           break;
         default: // case RAMP_DECEL:
+          #ifdef SHAPED_RAMPS
+            if (prep.ramp_shaped) {
+              st_prep_ramp_step(&time_var, &mm_remaining, prep.mm_complete);
+              break; // End of block or end of forced-deceleration when the ramp ends.
+            }
+          #endif
           // NOTE: mm_var used as a misc worker variable to prevent errors when near zero speed.
           speed_var = pl_block->acceleration*time_var; // Used as delta speed (mm/min)
           if (prep.current_speed > speed_var) { // Check if at or below zero speed.
@@ -821,6 +1225,15 @@ void st_prep_buffer()
       }
     } while (mm_remaining > prep.mm_complete); // **Complete** Exit loop. Profile complete.
 
+    #ifdef LASER_DYNAMIC_POWER
+      // Scale the laser power with the average speed of the segment, capped at the programmed power.
+      if (st_prep_block->laser_dynamic) {
+        float laser_pwm = prep.laser_scale*(pl_block->millimeters-mm_remaining)/dt;
+        if (laser_pwm > prep.laser_pwm) { laser_pwm = prep.laser_pwm; }
+        prep_segment->laser_pwm = laser_pwm;
+      }
+    #endif
+
    
     /* -----------------------------------------------------------------------------------
        Compute segment step rate, steps to execute, and apply necessary rate corrections.
@@ -866,36 +1279,7 @@ void st_prep_buffer()
     // Compute CPU cycles per step for the prepped segment.
     uint32_t cycles = ceil( (TICKS_PER_MICROSECOND*1000000*60)*inv_rate ); // (cycles/step)    
 
-    #ifdef ADAPTIVE_MULTI_AXIS_STEP_SMOOTHING        
-      // Compute step timing and multi-axis smoothing level.
-      // NOTE: AMASS overdrives the timer with each level, so only one prescalar is required.
-      if (cycles < AMASS_LEVEL1) { prep_segment->amass_level = 0; }
-      else {
-        if (cycles < AMASS_LEVEL2) { prep_segment->amass_level = 1; }
-        else if (cycles < AMASS_LEVEL3) { prep_segment->amass_level = 2; }
-        else { prep_segment->amass_level = 3; }    
-        cycles >>= prep_segment->amass_level; 
-        prep_segment->n_step <<= prep_segment->amass_level;
-      }
-      if (cycles < (1UL << 16)) { prep_segment->cycles_per_tick = cycles; } // < 65536 (4.1ms @ 16MHz)
-      else { prep_segment->cycles_per_tick = 0xffff; } // Just set the slowest speed possible.
-    #else 
-      // Compute step timing and timer prescalar for normal step generation.
-      if (cycles < (1UL << 16)) { // < 65536  (4.1ms @ 16MHz)
-        prep_segment->prescaler = 1; // prescaler: 0
-        prep_segment->cycles_per_tick = cycles;
-      } else if (cycles < (1UL << 19)) { // < 524288 (32.8ms@16MHz)
-        prep_segment->prescaler = 2; // prescaler: 8
-        prep_segment->cycles_per_tick = cycles >> 3;
-      } else { 
-        prep_segment->prescaler = 3; // prescaler: 64
-        if (cycles < (1UL << 22)) { // < 4194304 (262ms@16MHz)
-          prep_segment->cycles_per_tick =  cycles >> 6;
-        } else { // Just set the slowest speed possible. (Around 4 step/sec.)
-          prep_segment->cycles_per_tick = 0xffff;
-        }
-      }
-    #endif
+    st_prep_segment_rate(prep_segment, cycles);
 
     // Segment complete! Increment segment buffer indices.
     segment_buffer_head = segment_next_head;
@@ -38,12 +38,25 @@ void st_go_idle();
 // Generate the step and direction port invert masks.
 void st_generate_step_dir_invert_masks();
 
+// Generate the input shaper of each axis from the shaper settings.
+#ifdef INPUT_SHAPING
+void st_generate_input_shapers();
+#endif
+
 // Reset the stepper subsystem variables       
 void st_reset();
              
 // Reloads step segment buffer. Called continuously by realtime execution system.
 void st_prep_buffer();
 
+// Sets the laser power the prepped motion scales with its speed, from the output changes of a block.
+#ifdef LASER_DYNAMIC_POWER
+void st_update_laser_power(uint8_t output_bits, uint16_t *output_pwm);
+#endif
+
+// Copies the real-time machine position in steps. sys.position lags it by a few segments while moving.
+void st_get_position(int32_t *position);
+
 // Called by planner_recalculate() when the executing block is updated by the new plan.
 void st_update_plan_block_parameters();
 
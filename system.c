@@ -176,6 +176,14 @@ uint8_t system_execute_line(char *line)
           if ( line[++char_counter] != 0 ) { return(STATUS_INVALID_STATEMENT); }
           else { report_ngc_parameters(); }
           break;          
+        case 'K' : // Run the kinematics self test [IDLE/ALARM]
+          if ( line[++char_counter] != 0 ) { return(STATUS_INVALID_STATEMENT); }
+          else { 
+            kinematics_test_t result;
+            kinematics_self_test(&result);
+            report_kinematics_test(&result);
+          }
+          break;
         case 'H' : // Perform homing cycle [IDLE/ALARM] 
 			//printString(line[(char_counter+1)]);
 		  if (line[(char_counter+1)] == 'H' )
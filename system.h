@@ -78,7 +78,7 @@ typedef struct {
 
   uint8_t home_complate_flag;
   
-  int32_t position[N_AXIS];      // Real-time machine (aka home) position vector in steps. 
+  int32_t position[N_AXIS];      // Machine (aka home) position vector in steps. Lags the steppers while moving, see st_get_position().
                                  // NOTE: This may need to be a volatile variable, if problems arise.   
                                  
 